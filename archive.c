@@ -0,0 +1,271 @@
+// request/response archive for recording and replaying page loads
+//
+// a file is an 8 byte magic, then records, then an index:
+//
+//   record: struct record, key, headers, body, padded to 8 bytes
+//   index:  a power of two slots of (hash, record offset), 0 when empty
+//   footer: struct footer, last 24 bytes of the file
+//
+// records are appended as they arrive, and the index is written on close.
+// a replay maps the whole file and answers a lookup with one hash and a
+// probe or two into the mapped index, returning pointers into the mapping
+// without copying anything. if recording was cut short there is no
+// footer; the records are then scanned once to index them in memory.
+//
+// keys are content-addressed: the method and URI, plus a hash of the
+// request body when there is one. the hash is 64 bit FNV-1a.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "archive.h"
+
+#define MAGIC "MEMEARC1"
+#define RECORD 0x4345524d  // "MREC"
+#define INDEX 0x5844494d   // "MIDX"
+
+struct record {
+	uint32_t magic, key_len, headers_len, status;
+	uint64_t body_len, latency, hash;
+};
+
+struct slot {
+	uint64_t hash, offset;
+};
+
+struct footer {
+	uint64_t index, slots;
+	uint32_t magic, pad;
+};
+
+struct archive {
+	// recording
+	FILE *out;
+	uint64_t size;
+	// replay
+	const unsigned char *map;
+	size_t map_len;
+	// either: the mapped index, or one built in memory
+	struct slot *slots;
+	uint64_t width;
+	int count, own_slots;
+};
+
+static uint64_t
+hash64(const void *p, size_t n, uint64_t h)
+{
+	const unsigned char *s = p;
+	while (n--) { h ^= *s++; h *= 1099511628211ULL; }
+	return h;
+}
+static uint64_t
+key_hash(const char *key)
+{
+	uint64_t h = hash64(key, strlen(key), 14695981039346656037ULL);
+	// 0 marks an empty slot's offset, never a hash, but keep hashes nonzero anyway
+	return h ? h: 1;
+}
+char*
+archive_key(const char *method, const char *uri, const void *body, size_t len)
+{
+	const char *rest = strstr(uri, "://");
+	rest = rest ? rest + 1: uri;
+	size_t n = strlen(method) + strlen(rest) + 24;
+	char *key = malloc(n);
+	if (body && len)
+		snprintf(key, n, "%s %s #%016llx", method, rest,
+			(unsigned long long)hash64(body, len, 14695981039346656037ULL));
+	else
+		snprintf(key, n, "%s %s", method, rest);
+	return key;
+}
+static const struct record*
+record_at(struct archive *a, uint64_t offset)
+{
+	if (offset + sizeof(struct record) > a->map_len) return NULL;
+	const struct record *r = (const struct record*)(a->map + offset);
+	if (r->magic != RECORD || offset + sizeof(*r) + r->key_len + r->headers_len + r->body_len > a->map_len)
+		return NULL;
+	return r;
+}
+static const char*
+record_key(const struct record *r)
+{
+	return (const char*)(r + 1);
+}
+// the key of the record at offset, from the map or read back from disk
+static int
+same_key(struct archive *a, uint64_t offset, const char *key)
+{
+	size_t len = strlen(key);
+	if (a->map)
+	{
+		const struct record *r = record_at(a, offset);
+		return r && r->key_len == len && !memcmp(record_key(r), key, len);
+	}
+	struct record r;
+	char buf[len ? len: 1];
+	int fd = fileno(a->out);
+	if (pread(fd, &r, sizeof(r), offset) != sizeof(r) || r.key_len != len) return 0;
+	return pread(fd, buf, len, offset + sizeof(r)) == (ssize_t)len && !memcmp(buf, key, len);
+}
+static struct slot*
+probe(struct archive *a, uint64_t hash, const char *key)
+{
+	uint64_t i;
+	if (!a->width) return NULL;
+	for (i = hash & (a->width-1); a->slots[i].offset; i = (i+1) & (a->width-1))
+		if (a->slots[i].hash == hash && same_key(a, a->slots[i].offset, key)) return &a->slots[i];
+	return &a->slots[i];
+}
+static void
+insert(struct archive *a, uint64_t hash, uint64_t offset)
+{
+	uint64_t i, width;
+	if ((uint64_t)(a->count + 1) * 2 > a->width)
+	{
+		struct slot *old = a->slots;
+		width = a->width;
+		a->width = width ? width * 2: 1024;
+		a->slots = calloc(a->width, sizeof(struct slot));
+		for (i = 0; i < width; i++)
+		{
+			if (!old[i].offset) continue;
+			uint64_t j = old[i].hash & (a->width-1);
+			while (a->slots[j].offset) j = (j+1) & (a->width-1);
+			a->slots[j] = old[i];
+		}
+		free(old);
+		a->own_slots = 1;
+	}
+	for (i = hash & (a->width-1); a->slots[i].offset; i = (i+1) & (a->width-1));
+	a->slots[i].hash = hash;
+	a->slots[i].offset = offset;
+	a->count++;
+}
+struct archive*
+archive_create(const char *file)
+{
+	FILE *f = fopen(file, "w+");
+	if (!f) return NULL;
+	if (fwrite(MAGIC, 8, 1, f) != 1) { fclose(f); return NULL; }
+	struct archive *a = calloc(1, sizeof(struct archive));
+	a->out = f;
+	a->size = 8;
+	return a;
+}
+int
+archive_add(struct archive *a, const char *key, int status, const char *headers, size_t headers_len,
+	const void *body, size_t body_len, unsigned long long latency)
+{
+	static const char zero[8];
+	struct record r = { RECORD, strlen(key), headers_len, status, body_len, latency, key_hash(key) };
+	// pread sees what is still in stdio's buffer only once it is flushed
+	fflush(a->out);
+	struct slot *s = probe(a, r.hash, key);
+	if (s && s->offset) return 1;
+
+	size_t len = sizeof(r) + r.key_len + headers_len + body_len;
+	size_t pad = (8 - len % 8) % 8;
+	if (fwrite(&r, sizeof(r), 1, a->out) != 1
+		|| fwrite(key, 1, r.key_len, a->out) != r.key_len
+		|| fwrite(headers, 1, headers_len, a->out) != headers_len
+		|| fwrite(body, 1, body_len, a->out) != body_len
+		|| fwrite(zero, 1, pad, a->out) != pad)
+		return -1;
+	insert(a, r.hash, a->size);
+	a->size += len + pad;
+	return 0;
+}
+// an archive whose recording never finished: index what made it to disk
+static void
+scan(struct archive *a)
+{
+	uint64_t offset = 8;
+	const struct record *r;
+	while ((r = record_at(a, offset)))
+	{
+		uint64_t len = sizeof(*r) + r->key_len + r->headers_len + r->body_len;
+		insert(a, r->hash, offset);
+		offset += len + (8 - len % 8) % 8;
+	}
+}
+struct archive*
+archive_open(const char *file)
+{
+	struct stat st;
+	int fd = open(file, O_RDONLY|O_CLOEXEC);
+	if (fd < 0) return NULL;
+	if (fstat(fd, &st) || st.st_size < 8) { close(fd); return NULL; }
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return NULL;
+	if (memcmp(map, MAGIC, 8)) { munmap(map, st.st_size); return NULL; }
+
+	struct archive *a = calloc(1, sizeof(struct archive));
+	a->map = map;
+	a->map_len = st.st_size;
+	const struct footer *f = (const struct footer*)(a->map + a->map_len - sizeof(struct footer));
+	if (a->map_len >= 8 + sizeof(struct footer) && f->magic == INDEX && f->slots && !(f->slots & (f->slots-1))
+		&& f->index + f->slots * sizeof(struct slot) + sizeof(struct footer) == a->map_len)
+	{
+		a->slots = (struct slot*)(a->map + f->index);
+		a->width = f->slots;
+		for (uint64_t i = 0; i < a->width; i++) a->count += a->slots[i].offset != 0;
+	}
+	else scan(a);
+	// lookups touch the index at random
+	if (a->slots && !a->own_slots) madvise((void*)a->map, a->map_len, MADV_RANDOM);
+	return a;
+}
+int
+archive_find(struct archive *a, const char *key, struct archive_entry *e)
+{
+	struct slot *s = probe(a, key_hash(key), key);
+	const struct record *r;
+	if (!a->map || !s || !s->offset || !(r = record_at(a, s->offset))) return -1;
+	const char *p = record_key(r);
+	e->key = p;
+	e->status = r->status;
+	e->headers = p + r->key_len;
+	e->headers_len = r->headers_len;
+	e->body = p + r->key_len + r->headers_len;
+	e->body_len = r->body_len;
+	e->latency = r->latency;
+	return 0;
+}
+int
+archive_count(struct archive *a)
+{
+	return a->count;
+}
+int
+archive_close(struct archive *a)
+{
+	int rc = 0;
+	if (!a) return 0;
+	if (a->out)
+	{
+		struct footer f = { a->size, a->width, INDEX, 0 };
+		if (!a->width)
+		{
+			// an empty archive still gets a valid index of one slot
+			a->width = f.slots = 1;
+			a->slots = calloc(1, sizeof(struct slot));
+			a->own_slots = 1;
+		}
+		if (fwrite(a->slots, sizeof(struct slot), a->width, a->out) != a->width
+			|| fwrite(&f, sizeof(f), 1, a->out) != 1)
+			rc = -1;
+		if (fclose(a->out)) rc = -1;
+	}
+	if (a->map) munmap((void*)a->map, a->map_len);
+	if (a->own_slots) free(a->slots);
+	free(a);
+	return rc;
+}
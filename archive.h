@@ -0,0 +1,44 @@
+// request/response archive for recording and replaying page loads
+
+#ifndef MEME_ARCHIVE_H
+#define MEME_ARCHIVE_H
+
+#include <stddef.h>
+
+struct archive;
+
+struct archive_entry {
+	const char *key;
+	int status;
+	const char *headers;  // "Name: value\n" lines
+	size_t headers_len;
+	const void *body;
+	size_t body_len;
+	unsigned long long latency;  // ns from request to response headers
+};
+
+// the lookup key for a request. the scheme is left out, so a response
+// recorded over https answers the same request replayed over http.
+// caller frees
+char* archive_key(const char *method, const char *uri, const void *body, size_t len);
+
+// start a new archive, replacing file
+struct archive* archive_create(const char *file);
+
+// record a response. returns 1 if key was already recorded, which keeps
+// the first, and -1 on a write error
+int archive_add(struct archive *a, const char *key, int status, const char *headers, size_t headers_len,
+	const void *body, size_t body_len, unsigned long long latency);
+
+// map an archive for replay. one that was never closed is indexed afresh
+struct archive* archive_open(const char *file);
+
+// entry points into the mapping, valid until archive_close. 0 if found
+int archive_find(struct archive *a, const char *key, struct archive_entry *e);
+
+int archive_count(struct archive *a);
+
+// a recording gets its index written. returns -1 on a write error
+int archive_close(struct archive *a);
+
+#endif
@@ -0,0 +1,248 @@
+// microbenchmarks for meme's non-GTK hot paths: make bench
+//
+// each case runs until it has taken a fair fraction of a second and reports
+// ns and heap allocations per operation. data is generated at the sizes a
+// long-lived profile reaches: 10k cookies over 1000 sites, 100k bookmarks.
+// allocations are counted by wrapping malloc and friends at link time
+// (-Wl,--wrap), so only calls made from meme's own code are seen.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "util.h"
+#include "cookies.h"
+#include "bookmarks.h"
+#include "complete.h"
+#include "input.h"
+
+#define COOKIES 10000
+#define SITES 1000
+#define BOOKMARKS 100000
+#define MIN_NS 300000000ULL
+
+static unsigned long long allocs;
+
+void *__real_malloc(size_t n);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t n);
+char *__real_strdup(const char *s);
+
+void*
+__wrap_malloc(size_t n)
+{
+	allocs++;
+	return __real_malloc(n);
+}
+void*
+__wrap_calloc(size_t n, size_t size)
+{
+	allocs++;
+	return __real_calloc(n, size);
+}
+void*
+__wrap_realloc(void *p, size_t n)
+{
+	allocs++;
+	return __real_realloc(p, n);
+}
+char*
+__wrap_strdup(const char *s)
+{
+	allocs++;
+	return __real_strdup(s);
+}
+
+// a fixed sequence, so runs compare
+static unsigned int seed = 1;
+static unsigned int
+rnd()
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static char cookie_file[] = "/tmp/meme-bench-cookies.XXXXXX";
+static char bookmark_file[] = "/tmp/meme-bench-bookmarks.XXXXXX";
+static char **uris;
+
+static struct cookiejar *jar;
+static struct bookmarks *marks;
+static struct completion *comp;
+
+static const struct keycontrol keys[] = {
+	{ 8, 0xff50, "go-home" }, { 8, 0xff51, "go-back" }, { 8, 0xff53, "go-forward" },
+	{ 4, '=', "zoom-in" }, { 4, '-', "zoom-out" }, { 4, '0', "zoom-reset" },
+	{ 4, 's', "toggle-source" }, { 4, 'r', "reload-nocache" }, { 4, 'j', "run-scriptfile" },
+	{ 4, 'l', "focus-navbar" }, { 4, 't', "new-window" }, { 4, 'p', "print-page" },
+	{ 4, 'f', "find-text" }, { 4, 'b', "bookmark-page" }, { 4, 'n', "link-hints" },
+	{ 0, 0, NULL }
+};
+
+static void
+make_data()
+{
+	int i, fd;
+	FILE *f;
+	const char *tld[] = { "com", "org", "net", "co.uk", "io" };
+
+	fd = mkstemp(cookie_file);
+	f = fdopen(fd, "w");
+	fputs("# Netscape HTTP Cookie File\n", f);
+	for (i = 0; i < COOKIES; i++)
+	{
+		int site = rnd() % SITES;
+		fprintf(f, "%s%ssite%d.%s\t%s\t/%s\t%s\t%d\tname%d\tvalue%08x%08x\n",
+			i % 3 ? ".": "", i % 3 == 2 ? "www.": "", site, tld[site % 5], i % 3 ? "TRUE": "FALSE",
+			i % 4 ? "": "account", i % 7 ? "FALSE": "TRUE", 2000000000 + i, i, rnd(), rnd());
+	}
+	fclose(f);
+
+	uris = __real_malloc(BOOKMARKS * sizeof(char*));
+	fd = mkstemp(bookmark_file);
+	f = fdopen(fd, "w");
+	for (i = 0; i < BOOKMARKS; i++)
+	{
+		char uri[256];
+		snprintf(uri, sizeof(uri), "https://%s.site%d.%s/articles/%u/page-%d.html",
+			i % 2 ? "www": "news", rnd() % 5000, tld[i % 5], rnd() % 100000, i);
+		uris[i] = __real_strdup(uri);
+		fprintf(f, "%s\n", uri);
+	}
+	fclose(f);
+}
+
+static void
+mark_cb(const char *uri, int added, void *data)
+{
+	(*(int*)data)++;
+}
+
+static void
+cookie_load()
+{
+	cookiejar_free(cookiejar_new(cookie_file));
+}
+static void
+cookie_header()
+{
+	char host[64];
+	int site = rnd() % SITES;
+	snprintf(host, sizeof(host), "www.site%d.%s", site, site % 5 == 3 ? "co.uk": site % 5 == 0 ? "com":
+		site % 5 == 1 ? "org": site % 5 == 2 ? "net": "io");
+	free(cookiejar_header(jar, host, "/account/settings", site & 1));
+}
+static void
+bookmark_load()
+{
+	int n = 0;
+	struct bookmarks *b = bookmarks_new(bookmark_file);
+	bookmarks_sync(b, mark_cb, &n);
+	bookmarks_free(b);
+}
+static void
+bookmark_has()
+{
+	bookmarks_has(marks, uris[rnd() % BOOKMARKS]);
+}
+static void
+completion_build()
+{
+	int i;
+	struct completion *c = completion_new();
+	for (i = 0; i < BOOKMARKS; i++) completion_add(c, uris[i], 1);
+	completion_free(c);
+}
+static void
+completion_short()
+{
+	const char *out[10];
+	completion_match(comp, "news", out, 10);
+}
+static void
+completion_long()
+{
+	const char *out[10];
+	char key[32];
+	snprintf(key, sizeof(key), "site%u.com/art", rnd() % 5000);
+	completion_match(comp, key, out, 10);
+}
+static void
+entry_uri()
+{
+	char out[1024];
+	entry_classify("www.example.com/some/path?query=1", "http://duckduckgo.com/?q=%s", out, sizeof(out));
+}
+static void
+entry_search()
+{
+	char out[1024];
+	entry_classify("how to percent-encode a search term \xc3\xa9t\xc3\xa9", "http://duckduckgo.com/?q=%s",
+		out, sizeof(out));
+}
+static void
+key_dispatch()
+{
+	int i = key_find(keys, 4, 'n');
+	key_action_find(keys[i].action);
+}
+
+struct bench {
+	const char *name;
+	void (*fn)();
+};
+static struct bench benches[] = {
+	{ "cookie load, 10k cookies", cookie_load },
+	{ "cookie header, 10k cookies", cookie_header },
+	{ "bookmark load, 100k bookmarks", bookmark_load },
+	{ "bookmark lookup, 100k bookmarks", bookmark_has },
+	{ "completion build, 100k uris", completion_build },
+	{ "completion match, short key", completion_short },
+	{ "completion match, long key", completion_long },
+	{ "entry classify, uri", entry_uri },
+	{ "entry classify, search", entry_search },
+	{ "key dispatch", key_dispatch },
+	{ NULL, NULL }
+};
+
+int
+main(int argc, char **argv)
+{
+	int i, j;
+	make_data();
+	jar = cookiejar_new(cookie_file);
+	marks = bookmarks_new(bookmark_file);
+	bookmarks_sync(marks, mark_cb, &i);
+	comp = completion_new();
+	for (i = 0; i < BOOKMARKS; i++) completion_add(comp, uris[i], 1 + i % 7);
+
+	printf("%-34s %12s %10s %12s\n", "", "ns/op", "allocs/op", "ops");
+	for (i = 0; benches[i].name; i++)
+	{
+		// skip the benchmark unless named on the command line, if any are
+		if (argc > 1)
+		{
+			for (j = 1; j < argc && !strstr(benches[i].name, argv[j]); j++);
+			if (j == argc) continue;
+		}
+		unsigned long long ops = 0, batch = 1, start, took;
+		benches[i].fn();
+		allocs = 0;
+		start = now_ns();
+		while ((took = now_ns() - start) < MIN_NS)
+		{
+			for (j = 0; j < (int)batch; j++) benches[i].fn();
+			ops += batch;
+			if (batch < 1 << 20) batch *= 2;
+		}
+		printf("%-34s %12.1f %10.2f %12llu\n", benches[i].name,
+			(double)took / ops, (double)allocs / ops, ops);
+	}
+
+	cookiejar_free(jar);
+	bookmarks_free(marks);
+	completion_free(comp);
+	unlink(cookie_file);
+	unlink(bookmark_file);
+	return 0;
+}
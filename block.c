@@ -0,0 +1,426 @@
+// request blocking from EasyList-style filter lists and hosts files
+//
+// rules compile into two indexes: one to block, and one for the @@
+// exceptions that override it. "||host^" rules and hosts file lines go in
+// a hash set of domains, where a request's host and each parent domain is
+// looked up. the other rules are patterns filed under one token: a run of
+// [a-z0-9%] in the pattern that must also be a whole run in any URL the
+// pattern matches. a URL is split into runs the same way and only the
+// rules filed under its runs are tried, so a check touches a handful of
+// rules however long the lists are. the few patterns with no usable token
+// are tried every time.
+//
+// options other than third-party and match-case, element hiding and regex
+// rules are skipped: better to let a request through than to block what a
+// rule never meant to.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include "util.h"
+#include "block.h"
+
+enum { PARTY_ANY = 1, PARTY_THIRD = 2, PARTY_FIRST = 4 };
+
+struct rule {
+	char *pattern;      // anchors and redundant wildcards removed
+	unsigned int token; // hash of the token it is filed under, 0 if none
+	unsigned char host, start, end, party, match_case;
+	struct rule *next;
+};
+
+struct domain {
+	char *name;
+	unsigned int hash, len;
+	unsigned char party;  // PARTY_* bits it applies to
+	struct domain *next;
+};
+
+struct ruleset {
+	struct domain **domains;
+	unsigned int dwidth, dcount;
+	struct rule **tokens;
+	unsigned int twidth, tcount;
+	struct rule *generic;
+};
+
+struct blocker {
+	struct ruleset block, allow;
+	int count;
+};
+
+// tokens too common to narrow anything down, used only as a last resort
+static const char *weak_tokens[] = { "http", "https", "www", "com", "net", "org", NULL };
+
+static int
+token_char(int c)
+{
+	return isalnum(c) || c == '%';
+}
+static void
+ruleset_init(struct ruleset *r)
+{
+	r->dwidth = 1024;
+	r->domains = calloc(r->dwidth, sizeof(struct domain*));
+	r->twidth = 1024;
+	r->tokens = calloc(r->twidth, sizeof(struct rule*));
+}
+static void
+ruleset_clear(struct ruleset *r)
+{
+	unsigned int i;
+	struct domain *d, *dn;
+	struct rule *x, *xn;
+	for (i = 0; i < r->dwidth; i++)
+		for (d = r->domains[i]; d; d = dn) { dn = d->next; free(d->name); free(d); }
+	for (i = 0; i < r->twidth; i++)
+		for (x = r->tokens[i]; x; x = xn) { xn = x->next; free(x->pattern); free(x); }
+	for (x = r->generic; x; x = xn) { xn = x->next; free(x->pattern); free(x); }
+	free(r->domains);
+	free(r->tokens);
+}
+static struct domain*
+domain_find(struct ruleset *r, const char *name, unsigned int len)
+{
+	unsigned int hash = hash_mem(name, len);
+	struct domain *d;
+	for (d = r->domains[hash & (r->dwidth-1)]; d; d = d->next)
+		if (d->hash == hash && d->len == len && !memcmp(d->name, name, len)) return d;
+	return NULL;
+}
+static void
+domain_add(struct ruleset *r, const char *name, unsigned char party)
+{
+	unsigned int i, len = strlen(name);
+	struct domain *d = domain_find(r, name, len), *n;
+	if (d) { d->party |= party; return; }
+
+	if (r->dcount >= r->dwidth)
+	{
+		unsigned int width = r->dwidth * 2;
+		struct domain **domains = calloc(width, sizeof(struct domain*));
+		for (i = 0; i < r->dwidth; i++)
+		{
+			for (d = r->domains[i]; d; d = n)
+			{
+				n = d->next;
+				d->next = domains[d->hash & (width-1)];
+				domains[d->hash & (width-1)] = d;
+			}
+		}
+		free(r->domains);
+		r->domains = domains;
+		r->dwidth = width;
+	}
+	d = calloc(1, sizeof(struct domain));
+	d->name = strdup(name);
+	d->len = len;
+	d->hash = hash_mem(name, len);
+	d->party = party;
+	d->next = r->domains[d->hash & (r->dwidth-1)];
+	r->domains[d->hash & (r->dwidth-1)] = d;
+	r->dcount++;
+}
+static void
+rule_add(struct ruleset *r, struct rule *x)
+{
+	unsigned int i;
+	struct rule *y, *n;
+	if (!x->token) { x->next = r->generic; r->generic = x; return; }
+
+	if (r->tcount >= r->twidth * 2)
+	{
+		unsigned int width = r->twidth * 2;
+		struct rule **tokens = calloc(width, sizeof(struct rule*));
+		for (i = 0; i < r->twidth; i++)
+		{
+			for (y = r->tokens[i]; y; y = n)
+			{
+				n = y->next;
+				y->next = tokens[y->token & (width-1)];
+				tokens[y->token & (width-1)] = y;
+			}
+		}
+		free(r->tokens);
+		r->tokens = tokens;
+		r->twidth = width;
+	}
+	x->next = r->tokens[x->token & (r->twidth-1)];
+	r->tokens[x->token & (r->twidth-1)] = x;
+	r->tcount++;
+}
+// the longest run that is whole in every URL the pattern matches: not
+// against a wildcard, and at the pattern's ends only where it is anchored
+static unsigned int
+pick_token(struct rule *x)
+{
+	const char *p = x->pattern, *run, *best = NULL;
+	char lower[256];
+	int len, bestlen = 0, weak, bestweak = 1, i;
+	while (*p)
+	{
+		if (!token_char((unsigned char)*p)) { p++; continue; }
+		for (run = p; token_char((unsigned char)*p); p++);
+		len = p - run;
+		if (run == x->pattern ? !(x->start || x->host): run[-1] == '*') continue;
+		if (!*p ? !x->end: *p == '*') continue;
+		if (len >= (int)sizeof(lower)) continue;
+
+		for (i = 0; i < len; i++) lower[i] = tolower((unsigned char)run[i]);
+		lower[len] = '\0';
+		for (weak = 0, i = 0; weak_tokens[i]; i++) weak |= !strcmp(lower, weak_tokens[i]);
+		if (weak > bestweak || (weak == bestweak && len <= bestlen)) continue;
+		best = run; bestlen = len; bestweak = weak;
+	}
+	if (!best) return 0;
+	for (i = 0; i < bestlen; i++) lower[i] = tolower((unsigned char)best[i]);
+	unsigned int hash = hash_mem(lower, bestlen);
+	return hash ? hash: 1;
+}
+// does p match a prefix of s, or all of s with end
+static int
+glob(const char *p, const char *s, int end)
+{
+	for (; *p; p++)
+	{
+		if (*p == '*')
+		{
+			while (*p == '*') p++;
+			if (!*p) return 1;
+			for (; *s; s++) if (glob(p, s, end)) return 1;
+			return glob(p, s, end);
+		}
+		if (*p == '^')
+		{
+			// a separator, or the end of the address
+			if (!*s) continue;
+			if (token_char((unsigned char)*s) || strchr("_-.", *s)) return 0;
+			s++;
+			continue;
+		}
+		if (*p != *s) return 0;
+		s++;
+	}
+	return !end || !*s;
+}
+static int
+parse_options(struct rule *x, char *opts)
+{
+	char *o, *save = NULL;
+	for (o = strtok_r(opts, ",", &save); o; o = strtok_r(NULL, ",", &save))
+	{
+		if (!strcmp(o, "third-party") || !strcmp(o, "3p")) x->party = PARTY_THIRD;
+		else if (!strcmp(o, "~third-party") || !strcmp(o, "first-party") || !strcmp(o, "1p")) x->party = PARTY_FIRST;
+		else if (!strcmp(o, "match-case")) x->match_case = 1;
+		else return -1;
+	}
+	return 0;
+}
+// a hosts file line: "0.0.0.0 ads.example.com"
+static int
+parse_hosts(struct blocker *b, char *line)
+{
+	char addr[64], host[256];
+	if (!isdigit((unsigned char)line[0]) && line[0] != ':') return 0;
+	if (sscanf(line, "%63s %255s", addr, host) != 2) return 0;
+	if (!strchr(host, '.') || !strcmp(host, "localhost") || !strcmp(host, "0.0.0.0")) return -1;
+	char *p;
+	for (p = host; *p; p++) *p = tolower((unsigned char)*p);
+	domain_add(&b->block, host, PARTY_ANY);
+	return 1;
+}
+static int
+parse_line(struct blocker *b, char *line)
+{
+	size_t len = strlen(line);
+	while (len && isspace((unsigned char)line[len-1])) line[--len] = '\0';
+	while (isspace((unsigned char)*line)) line++;
+	if (!*line || *line == '!' || *line == '[' || *line == '#') return 0;
+	if (strstr(line, "##") || strstr(line, "#@#") || strstr(line, "#?#") || strstr(line, "#$#")) return 0;
+
+	int rc = parse_hosts(b, line);
+	if (rc) return rc > 0;
+
+	struct ruleset *set = &b->block;
+	if (!strncmp(line, "@@", 2)) { set = &b->allow; line += 2; }
+
+	struct rule x;
+	memset(&x, 0, sizeof(x));
+	x.party = PARTY_ANY;
+	char *dollar = strrchr(line, '$');
+	if (dollar && dollar[1] && !strchr(dollar, '/'))
+	{
+		*dollar = '\0';
+		if (parse_options(&x, dollar+1)) return 0;
+	}
+	len = strlen(line);
+	if (len > 1 && line[0] == '/' && line[len-1] == '/') return 0;
+
+	if (!strncmp(line, "||", 2)) { x.host = 1; line += 2; }
+	else if (*line == '|') { x.start = 1; line++; }
+	len = strlen(line);
+	if (len && line[len-1] == '|') { x.end = 1; line[--len] = '\0'; }
+	if (!x.host && !x.start) while (*line == '*') line++;
+	len = strlen(line);
+	if (!x.end) while (len && line[len-1] == '*') line[--len] = '\0';
+	if (!*line) return 0;
+
+	char *p;
+	if (!x.match_case) for (p = line; *p; p++) *p = tolower((unsigned char)*p);
+
+	// a bare host: into the domain set
+	if (x.host && !x.end)
+	{
+		for (p = line; *p && (isalnum((unsigned char)*p) || *p == '.' || *p == '-'); p++);
+		if ((!*p || (*p == '^' && !p[1])) && p > line)
+		{
+			*p = '\0';
+			domain_add(set, line, x.party);
+			return 1;
+		}
+	}
+	struct rule *r = malloc(sizeof(struct rule));
+	*r = x;
+	r->pattern = strdup(line);
+	r->token = pick_token(r);
+	rule_add(set, r);
+	return 1;
+}
+struct blocker*
+blocker_new()
+{
+	struct blocker *b = calloc(1, sizeof(struct blocker));
+	ruleset_init(&b->block);
+	ruleset_init(&b->allow);
+	return b;
+}
+void
+blocker_free(struct blocker *b)
+{
+	if (!b) return;
+	ruleset_clear(&b->block);
+	ruleset_clear(&b->allow);
+	free(b);
+}
+int
+blocker_load(struct blocker *b, const char *file)
+{
+	FILE *f = fopen(file, "r");
+	if (!f) return -1;
+	char *line = NULL;
+	size_t size = 0;
+	int n = 0;
+	while (getline(&line, &size, f) >= 0) n += parse_line(b, line);
+	free(line);
+	fclose(f);
+	b->count += n;
+	return n;
+}
+int
+blocker_load_dir(struct blocker *b, const char *dir)
+{
+	DIR *d = opendir(dir);
+	struct dirent *e;
+	int n = 0, rc;
+	if (!d) return 0;
+	while ((e = readdir(d)))
+	{
+		if (e->d_name[0] == '.') continue;
+		char path[strlen(dir) + strlen(e->d_name) + 2];
+		sprintf(path, "%s/%s", dir, e->d_name);
+		if ((rc = blocker_load(b, path)) > 0) n += rc;
+	}
+	closedir(d);
+	return n;
+}
+int
+blocker_count(struct blocker *b)
+{
+	return b->count;
+}
+struct request {
+	const char *uri, *lower;
+	unsigned int host, hostlen;  // offsets into uri
+	int third;
+};
+static int
+rule_match(struct rule *x, struct request *q)
+{
+	if (!(x->party & (q->third ? PARTY_ANY|PARTY_THIRD: PARTY_ANY|PARTY_FIRST))) return 0;
+	const char *s = x->match_case ? q->uri: q->lower, *p;
+	unsigned int i;
+	if (x->start) return glob(x->pattern, s, x->end);
+	if (x->host)
+	{
+		// at the start of the host or of any of its labels
+		for (i = 0; i < q->hostlen; i++)
+			if ((!i || q->lower[q->host+i-1] == '.') && glob(x->pattern, s + q->host + i, x->end)) return 1;
+		return 0;
+	}
+	char first = x->pattern[0] == '*' || x->pattern[0] == '^' ? 0: x->pattern[0];
+	for (p = s; *p; p++)
+		if ((!first || *p == first) && glob(x->pattern, p, x->end)) return 1;
+	return 0;
+}
+static int
+ruleset_match(struct ruleset *r, struct request *q)
+{
+	const char *h = q->lower + q->host, *end = h + q->hostlen, *p;
+	struct domain *d;
+	struct rule *x;
+	unsigned char party = q->third ? PARTY_ANY|PARTY_THIRD: PARTY_ANY|PARTY_FIRST;
+
+	// the host and each parent domain
+	while (h < end)
+	{
+		if ((d = domain_find(r, h, end - h)) && (d->party & party)) return 1;
+		if (!(h = memchr(h, '.', end - h))) break;
+		h++;
+	}
+	for (p = q->lower; *p; )
+	{
+		if (!token_char((unsigned char)*p)) { p++; continue; }
+		const char *run = p;
+		while (token_char((unsigned char)*p)) p++;
+		unsigned int hash = hash_mem(run, p - run);
+		if (!hash) hash = 1;
+		for (x = r->tokens[hash & (r->twidth-1)]; x; x = x->next)
+			if (x->token == hash && rule_match(x, q)) return 1;
+	}
+	for (x = r->generic; x; x = x->next)
+		if (rule_match(x, q)) return 1;
+	return 0;
+}
+int
+blocker_match(struct blocker *b, const char *uri, const char *page_host)
+{
+	if (!b->count) return 0;
+	size_t len = strlen(uri), i;
+	char stack[2048], *lower = len < sizeof(stack) ? stack: malloc(len+1);
+	for (i = 0; i <= len; i++) lower[i] = tolower((unsigned char)uri[i]);
+
+	struct request q = { uri, lower, 0, 0, 0 };
+	const char *h = strstr(lower, "://");
+	h = h ? h+3: lower;
+	size_t n = strcspn(h, "/?#");
+	const char *at = memchr(h, '@', n);
+	if (at) { n -= at+1 - h; h = at+1; }
+	const char *colon = memchr(h, ':', n);
+	if (colon) n = colon - h;
+	q.host = h - lower;
+	q.hostlen = n;
+
+	if (page_host && n < 256)
+	{
+		char host[256];
+		memcpy(host, h, n);
+		host[n] = '\0';
+		q.third = strcasecmp(host_registrable(host), host_registrable(page_host)) != 0;
+	}
+	int blocked = ruleset_match(&b->block, &q) && !ruleset_match(&b->allow, &q);
+	if (lower != stack) free(lower);
+	return blocked;
+}
@@ -0,0 +1,24 @@
+// request blocking from EasyList-style filter lists and hosts files
+
+#ifndef MEME_BLOCK_H
+#define MEME_BLOCK_H
+
+struct blocker;
+
+struct blocker* blocker_new();
+void blocker_free(struct blocker *b);
+
+// add one list's rules. returns the number of rules kept, or -1 if the
+// file can't be read. rules meme can't honour exactly are skipped
+int blocker_load(struct blocker *b, const char *file);
+
+// load every file in a directory, returning the total rules kept
+int blocker_load_dir(struct blocker *b, const char *dir);
+
+int blocker_count(struct blocker *b);
+
+// true if uri should not be fetched from a page on page_host, which may
+// be NULL when unknown
+int blocker_match(struct blocker *b, const char *uri, const char *page_host);
+
+#endif
@@ -0,0 +1,307 @@
+// the set of URIs in BOOKMARKFILE, kept in sync with the file
+//
+// each sync re-reads the file and tags every line it finds with a new
+// generation; entries left on the old generation were removed. callers only
+// ever see the difference, so a completion model can be patched in place.
+//
+// new bookmarks are appended to the file as one write under flock and made
+// durable in batches by bookmarks_flush, which every so often also rewrites
+// the file sorted and unique the way "sort -u" used to. the rewrite goes to
+// a temporary file renamed over the original, so a reader sees one whole
+// version or the other, and a crash leaves the old one.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "util.h"
+#include "bookmarks.h"
+
+struct mark {
+	char *uri;
+	unsigned int hash;
+	unsigned int gen;
+	struct mark *next;
+};
+
+// appends between sorted rewrites of the file
+#define COMPACT_EVERY 64
+
+struct bookmarks {
+	char *file;
+	struct mark **marks;
+	unsigned int width, count, gen;
+	struct stat seen;
+	int unsynced, appended;
+};
+
+static struct mark**
+bm_slot(struct bookmarks *b, const char *uri, unsigned int hash)
+{
+	struct mark **m = &b->marks[hash & (b->width-1)];
+	while (*m && ((*m)->hash != hash || strcmp((*m)->uri, uri))) m = &(*m)->next;
+	return m;
+}
+static void
+bm_rehash(struct bookmarks *b)
+{
+	unsigned int i, width = b->width * 2;
+	struct mark **marks = calloc(width, sizeof(struct mark*));
+	for (i = 0; i < b->width; i++)
+	{
+		struct mark *m = b->marks[i], *n;
+		for (; m; m = n)
+		{
+			n = m->next;
+			m->next = marks[m->hash & (width-1)];
+			marks[m->hash & (width-1)] = m;
+		}
+	}
+	free(b->marks);
+	b->marks = marks;
+	b->width = width;
+}
+static void
+bm_line(struct bookmarks *b, const char *line, bookmark_fn fn, void *data)
+{
+	unsigned int hash = hash_str(line);
+	struct mark **s = bm_slot(b, line, hash), *m = *s;
+	if (m)
+	{
+		m->gen = b->gen;
+		return;
+	}
+	m = malloc(sizeof(struct mark));
+	m->uri = strdup(line);
+	m->hash = hash;
+	m->gen = b->gen;
+	m->next = NULL;
+	*s = m;
+	if (++b->count > b->width) bm_rehash(b);
+	if (fn) fn(m->uri, 1, data);
+}
+struct bookmarks*
+bookmarks_new(const char *file)
+{
+	struct bookmarks *b = calloc(1, sizeof(struct bookmarks));
+	b->file = strdup(file);
+	b->width = 1024;
+	b->marks = calloc(b->width, sizeof(struct mark*));
+	return b;
+}
+void
+bookmarks_free(struct bookmarks *b)
+{
+	unsigned int i;
+	if (!b) return;
+	for (i = 0; i < b->width; i++)
+	{
+		struct mark *m = b->marks[i], *n;
+		for (; m; m = n) { n = m->next; free(m->uri); free(m); }
+	}
+	free(b->marks);
+	free(b->file);
+	free(b);
+}
+int
+bookmarks_sync(struct bookmarks *b, bookmark_fn fn, void *data)
+{
+	struct stat st;
+	char *buf = NULL, *line, *p;
+	ssize_t n, len = 0;
+	int rc = 0;
+
+	int fd = open(b->file, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st))
+	{
+		memset(&st, 0, sizeof(st));
+		rc = -1;
+	}
+	else
+	{
+		if (b->gen && st.st_ino == b->seen.st_ino && st.st_size == b->seen.st_size
+			&& st.st_mtim.tv_sec == b->seen.st_mtim.tv_sec && st.st_mtim.tv_nsec == b->seen.st_mtim.tv_nsec)
+		{
+			close(fd);
+			return 0;
+		}
+		buf = malloc(st.st_size+1);
+		while (len < st.st_size && (n = read(fd, buf+len, st.st_size-len)) > 0) len += n;
+	}
+	if (fd >= 0) close(fd);
+	b->seen = st;
+	b->gen++;
+
+	for (line = buf; line && line < buf+len; line = p+1)
+	{
+		p = memchr(line, '\n', buf+len-line);
+		if (!p) p = buf+len;
+		*p = '\0';
+		if (*line) bm_line(b, line, fn, data);
+	}
+	free(buf);
+
+	unsigned int i;
+	for (i = 0; i < b->width; i++)
+	{
+		struct mark **s = &b->marks[i], *m;
+		while ((m = *s))
+		{
+			if (m->gen == b->gen) { s = &m->next; continue; }
+			*s = m->next;
+			b->count--;
+			if (fn) fn(m->uri, 0, data);
+			free(m->uri);
+			free(m);
+		}
+	}
+	return rc;
+}
+int
+bookmarks_count(struct bookmarks *b)
+{
+	return b->count;
+}
+int
+bookmarks_has(struct bookmarks *b, const char *uri)
+{
+	return *bm_slot(b, uri, hash_str(uri)) != NULL;
+}
+static int
+same_file(struct stat *a, struct stat *b)
+{
+	return a->st_ino == b->st_ino && a->st_size == b->st_size
+		&& a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+// open and lock the file. one that was compacted while we waited for the
+// lock is no longer the file, so try again on its replacement
+static int
+open_locked(const char *file, int flags)
+{
+	struct stat st, now;
+	for (;;)
+	{
+		int fd = open(file, flags, 0644);
+		if (fd < 0) return -1;
+		flock(fd, LOCK_EX);
+		if (fstat(fd, &st) || stat(file, &now) || (st.st_dev == now.st_dev && st.st_ino == now.st_ino))
+			return fd;
+		close(fd);
+	}
+}
+int
+bookmarks_add(struct bookmarks *b, const char *uri)
+{
+	if (!*uri || strchr(uri, '\n') || bookmarks_has(b, uri)) return 0;
+
+	int fd = open_locked(b->file, O_WRONLY|O_APPEND|O_CREAT);
+	if (fd < 0) return -1;
+
+	struct stat st;
+	int current = !fstat(fd, &st) && b->gen && same_file(&st, &b->seen);
+
+	size_t n = strlen(uri);
+	char *line = malloc(n+1);
+	memcpy(line, uri, n);
+	line[n] = '\n';
+	int rc = write(fd, line, n+1) == (ssize_t)(n+1) ? 1: -1;
+	free(line);
+
+	if (rc > 0)
+	{
+		bm_line(b, uri, NULL, NULL);
+		b->unsynced++;
+		b->appended++;
+		// skip re-reading our own append, but not someone else's
+		if (current && !fstat(fd, &st)) b->seen = st;
+	}
+	flock(fd, LOCK_UN);
+	close(fd);
+	return rc;
+}
+static int
+by_line(const void *a, const void *b)
+{
+	return strcmp(*(char**)a, *(char**)b);
+}
+// rewrite the locked file fd sorted and unique, as a new file over it
+static int
+compact(const char *file, int fd)
+{
+	struct stat st;
+	if (fstat(fd, &st)) return -1;
+
+	char *buf = malloc(st.st_size+1), *line, *p;
+	ssize_t n, len = 0;
+	while (len < st.st_size && (n = pread(fd, buf+len, st.st_size-len, len)) > 0) len += n;
+	buf[len] = '\0';
+
+	char **lines = NULL;
+	int count = 0, size = 0, i;
+	for (line = buf; line < buf+len; line = p+1)
+	{
+		p = memchr(line, '\n', buf+len-line);
+		if (!p) p = buf+len;
+		*p = '\0';
+		if (!*line) continue;
+		if (count == size)
+		{
+			size = size ? size * 2: 1024;
+			lines = realloc(lines, size * sizeof(char*));
+		}
+		lines[count++] = line;
+	}
+	qsort(lines, count, sizeof(char*), by_line);
+
+	char *out = malloc(len+2), *o = out;
+	for (i = 0; i < count; i++)
+	{
+		if (i && !strcmp(lines[i], lines[i-1])) continue;
+		size_t l = strlen(lines[i]);
+		memcpy(o, lines[i], l);
+		o += l;
+		*o++ = '\n';
+	}
+	// the lock on the old file keeps other writers out until the rename
+	char tmp[strlen(file) + 8];
+	sprintf(tmp, "%s.tmp", file);
+	int rc = -1, out_fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, st.st_mode & 0777);
+	size_t done = 0, total = o - out;
+	if (out_fd >= 0)
+	{
+		while (done < total && (n = write(out_fd, out+done, total-done)) > 0) done += n;
+		rc = done == total && !fsync(out_fd) ? 0: -1;
+		if (close(out_fd) || (!rc && rename(tmp, file))) rc = -1;
+		if (rc) unlink(tmp);
+	}
+
+	free(out);
+	free(lines);
+	free(buf);
+	return rc;
+}
+int
+bookmarks_flush(struct bookmarks *b, int sort)
+{
+	if (!b->unsynced && !(sort && b->appended)) return 0;
+
+	int fd = open_locked(b->file, O_RDONLY);
+	if (fd < 0) return -1;
+
+	int rc;
+	if (sort || b->appended >= COMPACT_EVERY)
+	{
+		// the file changes under us; let the next sync re-read and diff it
+		rc = compact(b->file, fd);
+		b->appended = 0;
+	}
+	else rc = fdatasync(fd);
+	b->unsynced = 0;
+
+	flock(fd, LOCK_UN);
+	close(fd);
+	return rc;
+}
@@ -0,0 +1,29 @@
+// the set of URIs in BOOKMARKFILE, kept in sync with the file
+
+#ifndef MEME_BOOKMARKS_H
+#define MEME_BOOKMARKS_H
+
+struct bookmarks;
+
+// called once per URI that appeared in (added) or vanished from the file
+typedef void (*bookmark_fn)(const char *uri, int added, void *data);
+
+struct bookmarks* bookmarks_new(const char *file);
+void bookmarks_free(struct bookmarks *b);
+
+// re-read the file if it changed and report the difference. a missing file
+// counts as empty and returns -1
+int bookmarks_sync(struct bookmarks *b, bookmark_fn fn, void *data);
+
+int bookmarks_count(struct bookmarks *b);
+
+// append a URI to the set and the file. returns 1 if added, 0 if already
+// present, -1 on error. the caller updates its own views of the set
+int bookmarks_add(struct bookmarks *b, const char *uri);
+
+// make appended URIs durable. with sort, or after enough appends, rewrite
+// the file sorted with duplicates removed
+int bookmarks_flush(struct bookmarks *b, int sort);
+int bookmarks_has(struct bookmarks *b, const char *uri);
+
+#endif
@@ -0,0 +1,309 @@
+// ranked substring completion over URIs, indexed by trigram
+//
+// every URI is lowercased once and each of its trigrams gets a posting list
+// of entry ids. a query walks only the shortest posting list among its own
+// trigrams and confirms candidates with strstr. keys too short to have a
+// trigram, or whose rarest trigram is still very common, scan entries in
+// score order instead and stop once enough matches are in hand.
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "util.h"
+#include "complete.h"
+
+// posting lists longer than this are cheaper to replace with an ordered scan
+#define SCAN_POSTINGS 8192
+// an ordered scan ranks this many matches per requested result
+#define SCAN_SPREAD 4
+
+struct entry {
+	char *uri;    // NULL once removed
+	char *lower;
+	unsigned int len;
+	unsigned int next;  // hash chain, id+1
+	double score;
+};
+
+struct posting {
+	unsigned int tri;  // 0 for an empty slot
+	unsigned int count, size;
+	unsigned int *ids;
+};
+
+struct completion {
+	struct entry *entries;
+	unsigned int count, size, dead;
+	unsigned int *heads;
+	unsigned int width;
+	struct posting *postings;
+	unsigned int pwidth, pcount;
+	unsigned int *order;
+	unsigned int norder;
+	int sorted;
+};
+
+struct ranked {
+	unsigned int id;
+	double rank;
+};
+
+static unsigned int
+trigram(const char *s)
+{
+	return 0x1000000 | (unsigned char)s[0] << 16 | (unsigned char)s[1] << 8 | (unsigned char)s[2];
+}
+static struct posting*
+posting_find(struct completion *c, unsigned int tri, int create)
+{
+	unsigned int i = (tri * 2654435761u) & (c->pwidth-1);
+	while (c->postings[i].tri && c->postings[i].tri != tri) i = (i+1) & (c->pwidth-1);
+	if (c->postings[i].tri || !create) return c->postings[i].tri ? &c->postings[i]: NULL;
+
+	if ((c->pcount+1) * 2 > c->pwidth)
+	{
+		unsigned int j, width = c->pwidth * 2;
+		struct posting *old = c->postings;
+		c->postings = calloc(width, sizeof(struct posting));
+		for (j = 0; j < c->pwidth; j++)
+		{
+			if (!old[j].tri) continue;
+			i = (old[j].tri * 2654435761u) & (width-1);
+			while (c->postings[i].tri) i = (i+1) & (width-1);
+			c->postings[i] = old[j];
+		}
+		free(old);
+		c->pwidth = width;
+		return posting_find(c, tri, create);
+	}
+	c->postings[i].tri = tri;
+	c->pcount++;
+	return &c->postings[i];
+}
+static void
+index_entry(struct completion *c, unsigned int id)
+{
+	struct entry *e = &c->entries[id];
+	unsigned int i;
+	for (i = 0; i + 3 <= e->len; i++)
+	{
+		struct posting *p = posting_find(c, trigram(e->lower+i), 1);
+		// repeats of a trigram within one URI land consecutively
+		if (p->count && p->ids[p->count-1] == id) continue;
+		if (p->count == p->size)
+		{
+			p->size = p->size ? p->size * 2: 4;
+			p->ids = realloc(p->ids, p->size * sizeof(unsigned int));
+		}
+		p->ids[p->count++] = id;
+	}
+}
+static unsigned int*
+entry_slot(struct completion *c, const char *uri)
+{
+	unsigned int *s = &c->heads[hash_str(uri) & (c->width-1)];
+	while (*s && strcmp(c->entries[*s-1].uri, uri)) s = &c->entries[*s-1].next;
+	return s;
+}
+static void
+rehash(struct completion *c)
+{
+	unsigned int i;
+	while (c->width < c->count) c->width *= 2;
+	c->heads = realloc(c->heads, c->width * sizeof(unsigned int));
+	memset(c->heads, 0, c->width * sizeof(unsigned int));
+	for (i = 0; i < c->count; i++)
+	{
+		if (!c->entries[i].uri) continue;
+		unsigned int *s = &c->heads[hash_str(c->entries[i].uri) & (c->width-1)];
+		c->entries[i].next = *s;
+		*s = i+1;
+	}
+}
+static void
+rebuild(struct completion *c)
+{
+	unsigned int i, n = 0;
+	for (i = 0; i < c->pwidth; i++) free(c->postings[i].ids);
+	memset(c->postings, 0, c->pwidth * sizeof(struct posting));
+	c->pcount = 0;
+
+	for (i = 0; i < c->count; i++)
+		if (c->entries[i].uri) c->entries[n++] = c->entries[i];
+	c->count = n;
+	c->dead = 0;
+
+	rehash(c);
+	for (i = 0; i < c->count; i++) index_entry(c, i);
+	c->sorted = 0;
+}
+struct completion*
+completion_new()
+{
+	struct completion *c = calloc(1, sizeof(struct completion));
+	c->width = 1024;
+	c->heads = calloc(c->width, sizeof(unsigned int));
+	c->pwidth = 4096;
+	c->postings = calloc(c->pwidth, sizeof(struct posting));
+	return c;
+}
+void
+completion_free(struct completion *c)
+{
+	unsigned int i;
+	if (!c) return;
+	for (i = 0; i < c->count; i++) { free(c->entries[i].uri); free(c->entries[i].lower); }
+	for (i = 0; i < c->pwidth; i++) free(c->postings[i].ids);
+	free(c->entries);
+	free(c->heads);
+	free(c->postings);
+	free(c->order);
+	free(c);
+}
+void
+completion_add(struct completion *c, const char *uri, double score)
+{
+	unsigned int *s = entry_slot(c, uri), i;
+	if (*s)
+	{
+		struct entry *e = &c->entries[*s-1];
+		if (score > e->score) { e->score = score; c->sorted = 0; }
+		return;
+	}
+	if (c->count == c->size)
+	{
+		c->size = c->size ? c->size * 2: 1024;
+		c->entries = realloc(c->entries, c->size * sizeof(struct entry));
+		s = entry_slot(c, uri);
+	}
+	struct entry *e = &c->entries[c->count];
+	e->uri = strdup(uri);
+	e->len = strlen(uri);
+	e->lower = malloc(e->len+1);
+	for (i = 0; i <= e->len; i++) e->lower[i] = tolower((unsigned char)uri[i]);
+	e->score = score;
+	e->next = 0;
+	*s = ++c->count;
+	index_entry(c, c->count-1);
+	c->sorted = 0;
+
+	if (c->count > c->width * 2) rehash(c);
+}
+void
+completion_set_score(struct completion *c, const char *uri, double score)
+{
+	unsigned int *s = entry_slot(c, uri);
+	if (!*s) { completion_add(c, uri, score); return; }
+	c->entries[*s-1].score = score;
+	c->sorted = 0;
+}
+void
+completion_remove(struct completion *c, const char *uri)
+{
+	unsigned int *s = entry_slot(c, uri);
+	if (!*s) return;
+	struct entry *e = &c->entries[*s-1];
+	*s = e->next;
+	free(e->uri);
+	free(e->lower);
+	e->uri = e->lower = NULL;
+	c->sorted = 0;
+
+	// postings keep dead ids until enough pile up to be worth a rebuild
+	if (++c->dead > 1024 && c->dead * 2 > c->count) rebuild(c);
+}
+int
+completion_count(struct completion *c)
+{
+	return c->count - c->dead;
+}
+static int
+by_rank(const void *a, const void *b)
+{
+	const struct ranked *x = a, *y = b;
+	return x->rank < y->rank ? 1: x->rank > y->rank ? -1: (x->id > y->id) - (x->id < y->id);
+}
+static void
+sort_order(struct completion *c)
+{
+	struct ranked *r = malloc((c->count+1) * sizeof(struct ranked));
+	unsigned int i, n = 0;
+	for (i = 0; i < c->count; i++)
+		if (c->entries[i].uri) { r[n].id = i; r[n].rank = c->entries[i].score; n++; }
+	qsort(r, n, sizeof(struct ranked), by_rank);
+	c->order = realloc(c->order, (n+1) * sizeof(unsigned int));
+	for (i = 0; i < n; i++) c->order[i] = r[i].id;
+	c->norder = n;
+	c->sorted = 1;
+	free(r);
+}
+// matches on the host, then on a word boundary, beat matches mid-word.
+// shorter URIs win ties so the bare site sorts above its deep links
+static double
+rank(struct entry *e, const char *at)
+{
+	const char *host = strstr(e->lower, "://");
+	host = host ? host+3: e->lower;
+	if (!strncmp(host, "www.", 4)) host += 4;
+
+	double weight = at == host ? 4.0: (at == e->lower || strchr("./-_?=&#:", at[-1])) ? 2.0: 1.0;
+	return (e->score + 1.0) * weight / (1.0 + e->len / 64.0);
+}
+static int
+keep(struct ranked *top, int count, int n, unsigned int id, double r)
+{
+	if (count == n && r <= top[n-1].rank) return count;
+	int i = count < n ? count++: n-1;
+	for (; i > 0 && top[i-1].rank < r; i--) top[i] = top[i-1];
+	top[i].id = id;
+	top[i].rank = r;
+	return count;
+}
+int
+completion_match(struct completion *c, const char *key, const char **out, int n)
+{
+	unsigned int i, len = strlen(key);
+	if (!len || n <= 0) return 0;
+
+	char *lower = malloc(len+1);
+	for (i = 0; i <= len; i++) lower[i] = tolower((unsigned char)key[i]);
+
+	struct posting *best = NULL;
+	for (i = 0; i + 3 <= len; i++)
+	{
+		struct posting *p = posting_find(c, trigram(lower+i), 0);
+		if (!p) { free(lower); return 0; }
+		if (!best || p->count < best->count) best = p;
+	}
+
+	struct ranked *top = malloc(n * sizeof(struct ranked));
+	int count = 0;
+	const char *at;
+	if (best && best->count <= SCAN_POSTINGS)
+	{
+		for (i = 0; i < best->count; i++)
+		{
+			struct entry *e = &c->entries[best->ids[i]];
+			if (e->uri && (at = strstr(e->lower, lower)))
+				count = keep(top, count, n, best->ids[i], rank(e, at));
+		}
+	}
+	else
+	{
+		if (!c->sorted) sort_order(c);
+		unsigned int found = 0, limit = n * SCAN_SPREAD;
+		for (i = 0; i < c->norder && found < limit; i++)
+		{
+			struct entry *e = &c->entries[c->order[i]];
+			if ((at = strstr(e->lower, lower)))
+			{
+				count = keep(top, count, n, c->order[i], rank(e, at));
+				found++;
+			}
+		}
+	}
+	for (i = 0; i < (unsigned int)count; i++) out[i] = c->entries[top[i].id].uri;
+	free(top);
+	free(lower);
+	return count;
+}
@@ -0,0 +1,22 @@
+// ranked substring completion over URIs, indexed by trigram
+
+#ifndef MEME_COMPLETE_H
+#define MEME_COMPLETE_H
+
+struct completion;
+
+struct completion* completion_new();
+void completion_free(struct completion *c);
+
+// add a URI, keeping the higher score if already present. score is the caller's
+// notion of how useful the URI is: 1 for a bookmark, frecency for history
+void completion_add(struct completion *c, const char *uri, double score);
+void completion_set_score(struct completion *c, const char *uri, double score);
+void completion_remove(struct completion *c, const char *uri);
+int completion_count(struct completion *c);
+
+// up to n URIs containing key (case insensitive), best first. the strings
+// remain valid until the next add or remove
+int completion_match(struct completion *c, const char *key, const char **out, int n);
+
+#endif
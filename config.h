@@ -18,25 +18,133 @@
 #define ONLOADFILE MEMEDIR "onload.js"
 //#define ONLOADFILE NULL
 
+// where ONLOADFILE runs
+// INJECT_ALL_FRAMES: every frame's onload, iframes included
+// INJECT_MAIN_FRAME: the main frame's onload only
+// INJECT_LAZY: the main frame, just before the first jskeys action
+#define ONLOADINJECT INJECT_MAIN_FRAME
+
 // default CSS
 // NULL to ignore
 #define STYLEFILE "file://" MEMEDIR "style.css"
 //#define STYLEFILE NULL
 
-// also see cookies setting in DOWNLOAD, below
 // NULL to ignore
 #define COOKIEFILE MEMEDIR "cookies"
 
+// HTTP cache directories, numbered from 0. NULL to ignore
+#define CACHEDIR MEMEDIR "cache/"
+
+// bytes of HTTP cache on disk, split evenly between CACHESLOTS directories.
+// up to CACHESLOTS meme processes at once get a disk cache, the rest none
+#define CACHESIZE (256 * 1024 * 1024)
+#define CACHESLOTS 4
+
+// how much webkit keeps in its memory and back/forward page caches while
+// within MEMORYBUDGET. WEBKIT_CACHE_MODEL_WEB_BROWSER keeps the most,
+// WEBKIT_CACHE_MODEL_DOCUMENT_VIEWER next to nothing
+#define CACHEMODEL WEBKIT_CACHE_MODEL_WEB_BROWSER
+
+// resident bytes for this process, and for every meme process together.
+// over either, webkit's caches are cut to nothing and JavaScript collects
+// its garbage until memory falls back well under. 0 for no limit
+#define MEMORYBUDGET (512ULL * 1024 * 1024)
+#define MEMORYBUDGETALL (1536ULL * 1024 * 1024)
+
+// milliseconds between memory samples
+#define MEMORYSAMPLE 2000
+
+// microseconds tasks may stall waiting on memory in any 2 seconds before
+// the kernel's pressure notification trims too. 0 to ignore
+#define MEMORYPRESSURE 150000
+
+// where each process publishes its memory use for MEMORYBUDGETALL
+// NULL to budget this process only
+#define MEMORYFILE MEMEDIR "memory"
+
+// a folder of EasyList-style filter lists and hosts files. requests they
+// match are never sent. NULL to ignore
+#define BLOCKDIR MEMEDIR "block"
+
+// host patterns and the settings pages on them get, one site per line:
+//   example.com images=off scripts=off plugins=off spell=off pagecache=on
+// a pattern covers subdomains too, and "*" every site. a window can still
+// override a setting with "!scripts on" and so on, or "!scripts" to drop
+// its override. NULL to ignore
+#define POLICYFILE MEMEDIR "policy"
+
 // list of urls
 // NULL to ignore
 #define BOOKMARKFILE MEMEDIR "bookmarks"
 
+// milliseconds to collect new bookmarks before syncing BOOKMARKFILE to disk
+#define BOOKMARKFLUSH 1000
+
+// visited urls, ranked by frecency for URI bar completion
+// NULL to ignore
+#define HISTORYFILE MEMEDIR "history"
+
+// days for the weight of a visit to halve
+#define HISTORYHALFLIFE 30
+
+// most URI bar completions offered at once, best first
+#define COMPLETIONS 20
+
+// milliseconds the pointer must rest on a link, or a completion stay first,
+// before its host is resolved and connected to ahead of a click. 0 to disable
+#define PRECONNECTDWELL 150
+
+// most speculative connections live at once, and seconds each is expected
+// to stay warm in the pool
+#define PRECONNECTMAX 6
+#define PRECONNECTIDLE 10
+
+// milliseconds on a link, or a completion staying first, before the page
+// itself is fetched into the HTTP cache ahead of a click. needs CACHEDIR
+// the fetch is a real GET with your cookies, so off by default: 400 is a
+// good value to turn it on. links to the page's own site and URIs with a
+// query are never prefetched. 0 to disable
+#define PREFETCHDWELL 0
+
+// largest document prefetched, in bytes. only one is in flight at a time
+#define PREFETCHBYTES (1024 * 1024)
+
+// seconds a prefetched page counts as used if visited
+#define PREFETCHIDLE 300
+
+// a folder where each meme process keeps its meters as pid.json, the same
+// as "!stats json" shows, for monitoring to collect. the file goes when
+// the process exits. NULL to ignore
+#define STATSDIR MEMEDIR "stats/"
+
+// seconds between rewrites of the STATSDIR file
+#define STATSSAVE 30
+
+// benchmark mode, meme -b FILE [-n RUNS]: runs of each URL in FILE unless
+// -n says otherwise, milliseconds the network must stay idle after onload
+// for a load to be over, and milliseconds before a load counts as failed
+#define BENCHRUNS 5
+#define BENCHIDLE 500
+#define BENCHTIMEOUT 30000
+
+// true to hold each response replayed with -R FILE for as long as it took
+// to arrive when recorded with -r FILE
+#define REPLAYLATENCY TRUE
+
+// where "!trace" writes a timeline of requests, scripts, page loads, key
+// actions and spawned commands, for chrome://tracing or Perfetto. %d is
+// replaced with the process id. "!trace FILE" or -t FILE pick another
+#define TRACEFILE MEMEDIR "trace.%d.json"
+
 // %s is replace with the search term, url encoded
 #define SEARCHURL "http://duckduckgo.com/?q=%s"
 
 // default cookie life
 #define SESSIONTIME 86400
 
+// milliseconds to collect new cookies before writing them to COOKIEFILE
+#define COOKIEFLUSH 2000
+
 // check and change 'en-AU'
 //#define USERAGENT "Meme/1.0 (X11; U; Unix; en-AU) AppleWebKit/531.2+ Compatible (Safari)"
 #define USERAGENT "Mozilla/5.0 (X11; x86_64) AppleWebKit (KHTML, like Gecko) Chrome"
@@ -46,13 +154,55 @@
 #define WIDTH 1024
 #define HEIGHT 768
 
-// runs wget in an xterm.
-#define DOWNLOAD(uri, file, ref, cwd) \
+// most connections the network session opens to one host
+#define CONNSPERHOST 8
+
+// emulate a poor network link inside meme, with no root or qdisc needed:
+// milliseconds added to every response, response bytes per second shared by
+// every request, percent of responses that lose a packet and wait NETEMRTO
+// milliseconds for it again, and connections per host in place of
+// CONNSPERHOST. 0 disables each. "!netem" shows or changes them at run time:
+// "!netem 3g", "!netem 300 94000 0.5 4" or "!netem off"
+#define NETEMDELAY 0
+#define NETEMRATE 0
+#define NETEMLOSS 0
+#define NETEMRTO 1000
+#define NETEMCONNS 0
+
+// downloads run in-process on the browser's connections and cookies, into
+// the working directory. at most this many at once, the rest queue
+#define DOWNLOADS 3
+
+// byte-range requests in parallel per download, for servers that allow it
+#define DOWNLOADSEGMENTS 4
+
+// downloads unfinished at exit, taken up again by the next meme to start.
+// NULL to leave them until asked for again
+#define DOWNLOADFILE MEMEDIR "downloads"
+
+// UNIX socket a single-process meme listens on for URIs to open
+#define CONTROLSOCKET MEMEDIR "control"
+
+// hidden meme processes kept ready with a window and web view already
+// built, so a new window only has to load its page. ignored with flag_single
+// each is a full WebKit process holding memory and a CACHESLOTS slot, so
+// off by default: 2 is enough to hide most startup time. 0 to disable
+#define STANDBYPOOL 0
+
+// seconds an unused standby waits before exiting, so an idle pool doesn't
+// outlive its use or keep running an old binary. 0 to wait forever
+#define STANDBYIDLE 600
+
+// milliseconds after startup before refilling the standby pool
+#define STANDBYDELAY 2000
+
+// starts a standby process for a pool slot
+#define STANDBYWINDOW(slot, flags) \
 	(const char *[]){ "/bin/sh", "-c", \
-	"xterm -e \"wget --load-cookies " COOKIEFILE " --user-agent='" USERAGENT "' --referer='$3' -O '$1/$2' '$0';\"", \
-	uri, cwd, file, ref, NULL }
+	"meme $1 -w \"$0\"", slot, flags, NULL }
 
-// starts a new window as a separate process
+// starts a new window as a separate process when the standby pool is empty
+// unused with flag_single
 #define NEWWINDOW(uri) \
 	(const char *[]){ "/bin/sh", "-c", \
 	"meme \"$0\"", uri, NULL }
@@ -76,17 +226,29 @@ struct keycontrol keys[] = {
 	{ CTL, GDK_p,     "print-page"     },
 	{ CTL, GDK_f,     "find-text"      },
 	{ CTL, GDK_b,     "bookmark-page"  },
+	{ CTL, GDK_n,     "link-hints"     },
 	{ 0, 0, NULL }
 };
 
 // launch javascript fragments defined in onload.js
 struct keycontrol jskeys[] = {
 	// modifier, key, action
-	{ CTL, GDK_n, "window.meme.links()" },
+	// the old jQuery link hints, superseded by "link-hints" above
+	//{ CTL, GDK_n, "window.meme.links()" },
 	{ 0, 0, NULL }
 };
 
 
 // true to enable webkit plugins (flash, etc) by default
-// when false, can still be enabled on the fly with "!plugins on"
+// when false, can still be enabled on the fly with "!plugins on", or per
+// site in POLICYFILE
 gboolean flag_plugins = FALSE;
+
+// true to open every window in one process sharing the network session,
+// cache and cookies. later invocations hand their URI over CONTROLSOCKET
+// same as running with -s
+gboolean flag_single = FALSE;
+
+// true to block requests matching BLOCKDIR lists by default
+// can be changed per window with "!block on", "!block off" or just "!block"
+gboolean flag_block = TRUE;
@@ -0,0 +1,411 @@
+// in-memory cookie store backed by a Netscape/libsoup cookies.txt file
+//
+// cookies are bucketed by registrable domain so a request only looks at
+// cookies that could possibly match its host. each bucket is kept sorted by
+// descending path length, which is the order RFC 6265 wants them sent in.
+//
+// new cookies go straight into the index and onto a pending list. a flush
+// merges the pending list with whatever other processes have written since,
+// drops expired and duplicate entries, and rewrites the file once under lock.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "util.h"
+#include "cookies.h"
+
+struct site {
+	char *key;
+	struct cookie **cookies;
+	int count, size;
+	struct site *next;
+};
+
+struct cookiejar {
+	char *file;
+	int seen;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	struct site **sites;
+	unsigned int width;
+	unsigned int nsites;
+	int count;
+	struct cookie **pending;
+	int npending, spending;
+};
+
+static struct cookie*
+cookie_new(const char *name, const char *value, const char *domain, const char *path)
+{
+	size_t ln = strlen(name)+1, lv = strlen(value)+1, ld = strlen(domain)+1, lp = strlen(path)+1;
+	struct cookie *c = malloc(sizeof(struct cookie) + ln + lv + ld + lp);
+	char *p = (char*)(c+1);
+	c->name = memcpy(p, name, ln); p += ln;
+	c->value = memcpy(p, value, lv); p += lv;
+	c->domain = memcpy(p, domain, ld); p += ld;
+	c->path = memcpy(p, path, lp);
+	c->expires = 0;
+	c->secure = 0;
+	c->httponly = 0;
+	return c;
+}
+static struct cookie*
+cookie_copy(struct cookie *o)
+{
+	struct cookie *c = cookie_new(o->name, o->value, o->domain, o->path);
+	c->expires = o->expires;
+	c->secure = o->secure;
+	c->httponly = o->httponly;
+	return c;
+}
+static void
+jar_clear(struct cookiejar *jar)
+{
+	unsigned int i; int j;
+	for (i = 0; i < jar->width; i++)
+	{
+		struct site *s = jar->sites[i], *n;
+		for (; s; s = n)
+		{
+			n = s->next;
+			for (j = 0; j < s->count; j++) free(s->cookies[j]);
+			free(s->cookies);
+			free(s->key);
+			free(s);
+		}
+		jar->sites[i] = NULL;
+	}
+	jar->nsites = 0;
+	jar->count = 0;
+}
+static void
+jar_rehash(struct cookiejar *jar)
+{
+	unsigned int i, width = jar->width * 2;
+	struct site **sites = calloc(width, sizeof(struct site*));
+	for (i = 0; i < jar->width; i++)
+	{
+		struct site *s = jar->sites[i], *n;
+		for (; s; s = n)
+		{
+			n = s->next;
+			unsigned int h = hash_str(s->key) & (width-1);
+			s->next = sites[h];
+			sites[h] = s;
+		}
+	}
+	free(jar->sites);
+	jar->sites = sites;
+	jar->width = width;
+}
+static struct site*
+jar_site(struct cookiejar *jar, const char *key, int create)
+{
+	unsigned int h = hash_str(key) & (jar->width-1);
+	struct site *s;
+	for (s = jar->sites[h]; s; s = s->next)
+		if (!strcmp(s->key, key)) return s;
+	if (!create) return NULL;
+
+	s = calloc(1, sizeof(struct site));
+	s->key = strdup(key);
+	s->next = jar->sites[h];
+	jar->sites[h] = s;
+	if (++jar->nsites > jar->width) jar_rehash(jar);
+	return s;
+}
+static void
+jar_insert(struct cookiejar *jar, struct cookie *c)
+{
+	struct site *s = jar_site(jar, host_registrable(c->domain), 1);
+	int i, len = strlen(c->path);
+
+	for (i = 0; i < s->count; i++)
+	{
+		struct cookie *o = s->cookies[i];
+		if (!strcmp(o->name, c->name) && !strcmp(o->domain, c->domain) && !strcmp(o->path, c->path))
+		{
+			free(o);
+			s->cookies[i] = c;
+			return;
+		}
+	}
+	if (s->count == s->size)
+	{
+		s->size = s->size ? s->size * 2: 4;
+		s->cookies = realloc(s->cookies, s->size * sizeof(struct cookie*));
+	}
+	for (i = s->count; i > 0 && (int)strlen(s->cookies[i-1]->path) < len; i--)
+		s->cookies[i] = s->cookies[i-1];
+	s->cookies[i] = c;
+	s->count++;
+	jar->count++;
+}
+// domain \t flag \t path \t secure \t expires \t name \t value
+static void
+jar_parse_line(struct cookiejar *jar, char *line, long long now)
+{
+	char *f[7];
+	int i, httponly = 0;
+
+	if (!strncmp(line, "#HttpOnly_", 10))
+	{
+		httponly = 1;
+		line += 10;
+	}
+	else if (*line == '#' || !*line) return;
+
+	for (i = 0; i < 7; i++)
+	{
+		f[i] = line;
+		line = strchr(line, '\t');
+		if (!line && i < 6) return;
+		if (line) *line++ = '\0';
+	}
+	long long expires = strtoll(f[4], NULL, 10);
+	if (expires && expires <= now) return;
+
+	struct cookie *c = cookie_new(f[5], f[6], f[0], f[2]);
+	c->expires = expires;
+	c->secure = !strcmp(f[3], "TRUE");
+	c->httponly = httponly;
+	jar_insert(jar, c);
+}
+static void
+jar_load(struct cookiejar *jar, int fd)
+{
+	struct stat st;
+	char *buf, *line, *p;
+	ssize_t n, len = 0;
+
+	jar_clear(jar);
+	if (fstat(fd, &st)) return;
+	buf = malloc(st.st_size+1);
+	while (len < st.st_size && (n = read(fd, buf+len, st.st_size-len)) > 0) len += n;
+	buf[len] = '\0';
+
+	long long now = time(NULL);
+	for (line = buf; line < buf+len; line = p+1)
+	{
+		p = strchr(line, '\n');
+		if (!p) p = buf+len;
+		*p = '\0';
+		if (p > line && p[-1] == '\r') p[-1] = '\0';
+		jar_parse_line(jar, line, now);
+	}
+	free(buf);
+
+	// unflushed cookies are newer than anything on disk
+	int i;
+	for (i = 0; i < jar->npending; i++)
+		jar_insert(jar, cookie_copy(jar->pending[i]));
+}
+static void
+jar_seen(struct cookiejar *jar, struct stat *st)
+{
+	jar->seen = 1;
+	jar->dev = st->st_dev;
+	jar->ino = st->st_ino;
+	jar->size = st->st_size;
+	jar->mtime = st->st_mtim;
+}
+struct cookiejar*
+cookiejar_new(const char *file)
+{
+	struct cookiejar *jar = calloc(1, sizeof(struct cookiejar));
+	jar->file = strdup(file);
+	jar->width = 256;
+	jar->sites = calloc(jar->width, sizeof(struct site*));
+	cookiejar_sync(jar);
+	return jar;
+}
+void
+cookiejar_free(struct cookiejar *jar)
+{
+	if (!jar) return;
+	jar_clear(jar);
+	while (jar->npending) free(jar->pending[--jar->npending]);
+	free(jar->pending);
+	free(jar->sites);
+	free(jar->file);
+	free(jar);
+}
+int
+cookiejar_sync(struct cookiejar *jar)
+{
+	struct stat st;
+	if (stat(jar->file, &st))
+	{
+		if (!jar->seen) return 0;
+		jar->seen = 0;
+		jar_clear(jar);
+		return 1;
+	}
+	if (jar->seen && st.st_dev == jar->dev && st.st_ino == jar->ino && st.st_size == jar->size
+		&& st.st_mtim.tv_sec == jar->mtime.tv_sec && st.st_mtim.tv_nsec == jar->mtime.tv_nsec)
+		return 0;
+
+	int fd = open(jar->file, O_RDONLY);
+	if (fd < 0) return 0;
+	flock(fd, LOCK_SH);
+	fstat(fd, &st);
+	jar_load(jar, fd);
+	flock(fd, LOCK_UN);
+	close(fd);
+	jar_seen(jar, &st);
+	return 1;
+}
+static int
+domain_match(const char *domain, const char *host)
+{
+	if (*domain != '.') return !strcasecmp(domain, host);
+	if (!strcasecmp(domain+1, host)) return 1;
+	size_t hl = strlen(host), dl = strlen(domain);
+	return hl > dl && !strcasecmp(host+hl-dl, domain);
+}
+static int
+path_match(const char *cpath, const char *path)
+{
+	size_t n = strlen(cpath);
+	if (strncmp(cpath, path, n)) return 0;
+	return !path[n] || (n && cpath[n-1] == '/') || path[n] == '/';
+}
+char*
+cookiejar_header(struct cookiejar *jar, const char *host, const char *path, int https)
+{
+	struct site *s = jar_site(jar, host_registrable(host), 0);
+	if (!s) return NULL;
+	if (!path || !*path) path = "/";
+
+	long long now = time(NULL);
+	char *buf = NULL;
+	size_t len = 0, size = 0;
+	int i;
+	for (i = 0; i < s->count; i++)
+	{
+		struct cookie *c = s->cookies[i];
+		if ((c->expires && c->expires <= now) || (c->secure && !https)
+			|| !domain_match(c->domain, host) || !path_match(c->path, path))
+			continue;
+
+		size_t ln = strlen(c->name), lv = strlen(c->value);
+		if (len + ln + lv + 4 > size)
+		{
+			size = (len + ln + lv + 4) * 2;
+			buf = realloc(buf, size);
+		}
+		if (len) { memcpy(buf+len, "; ", 2); len += 2; }
+		if (ln) { memcpy(buf+len, c->name, ln); len += ln; buf[len++] = '='; }
+		memcpy(buf+len, c->value, lv); len += lv;
+		buf[len] = '\0';
+	}
+	return buf;
+}
+int
+cookiejar_count(struct cookiejar *jar)
+{
+	return jar->count;
+}
+void
+cookiejar_add(struct cookiejar *jar, struct cookie *c)
+{
+	c = cookie_copy(c);
+	jar_insert(jar, cookie_copy(c));
+
+	int i;
+	for (i = 0; i < jar->npending; i++)
+	{
+		struct cookie *o = jar->pending[i];
+		if (!strcmp(o->name, c->name) && !strcmp(o->domain, c->domain) && !strcmp(o->path, c->path))
+		{
+			free(o);
+			jar->pending[i] = c;
+			return;
+		}
+	}
+	if (jar->npending == jar->spending)
+	{
+		jar->spending = jar->spending ? jar->spending * 2: 16;
+		jar->pending = realloc(jar->pending, jar->spending * sizeof(struct cookie*));
+	}
+	jar->pending[jar->npending++] = c;
+}
+int
+cookiejar_pending(struct cookiejar *jar)
+{
+	return jar->npending;
+}
+static void
+buf_append(char **buf, size_t *len, size_t *size, const char *s)
+{
+	size_t n = strlen(s);
+	if (*len + n + 1 > *size)
+	{
+		*size = (*len + n + 1) * 2;
+		*buf = realloc(*buf, *size);
+	}
+	memcpy(*buf + *len, s, n+1);
+	*len += n;
+}
+int
+cookiejar_flush(struct cookiejar *jar)
+{
+	if (!jar->npending) return 0;
+
+	int fd = open(jar->file, O_RDWR|O_CREAT, 0600);
+	if (fd < 0 || flock(fd, LOCK_EX))
+	{
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	// merge: reload whatever is on disk now, then replay pending on top
+	jar_load(jar, fd);
+	while (jar->npending) free(jar->pending[--jar->npending]);
+
+	long long now = time(NULL);
+	char *buf = NULL, line[64];
+	size_t len = 0, size = 0;
+	unsigned int i; int j;
+	for (i = 0; i < jar->width; i++)
+	{
+		struct site *s;
+		for (s = jar->sites[i]; s; s = s->next)
+		{
+			for (j = 0; j < s->count; j++)
+			{
+				struct cookie *c = s->cookies[j];
+				// session cookies stay in memory, as with SoupCookieJarText
+				if (!c->expires || c->expires <= now) continue;
+				if (c->httponly) buf_append(&buf, &len, &size, "#HttpOnly_");
+				buf_append(&buf, &len, &size, c->domain);
+				buf_append(&buf, &len, &size, *c->domain == '.' ? "\tTRUE\t": "\tFALSE\t");
+				buf_append(&buf, &len, &size, c->path);
+				snprintf(line, sizeof(line), "\t%s\t%lld\t", c->secure ? "TRUE": "FALSE", c->expires);
+				buf_append(&buf, &len, &size, line);
+				buf_append(&buf, &len, &size, c->name);
+				buf_append(&buf, &len, &size, "\t");
+				buf_append(&buf, &len, &size, c->value);
+				buf_append(&buf, &len, &size, "\n");
+			}
+		}
+	}
+	size_t off = 0;
+	ssize_t n = 0;
+	while (off < len && (n = pwrite(fd, buf+off, len-off, off)) > 0) off += n;
+	int rc = off == len && !ftruncate(fd, len) ? 0: -1;
+	free(buf);
+
+	struct stat st;
+	if (!fstat(fd, &st)) jar_seen(jar, &st);
+	flock(fd, LOCK_UN);
+	close(fd);
+	return rc;
+}
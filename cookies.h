@@ -0,0 +1,39 @@
+// in-memory cookie store backed by a Netscape/libsoup cookies.txt file
+
+#ifndef MEME_COOKIES_H
+#define MEME_COOKIES_H
+
+struct cookie {
+	char *name;
+	char *value;
+	char *domain;  // leading '.' for domain cookies, bare for host-only
+	char *path;
+	long long expires;
+	int secure;
+	int httponly;
+};
+
+struct cookiejar;
+
+struct cookiejar* cookiejar_new(const char *file);
+void cookiejar_free(struct cookiejar *jar);
+
+// reload the file if its inode, size or mtime changed since last seen.
+// returns 1 when the jar was reloaded
+int cookiejar_sync(struct cookiejar *jar);
+
+// a Cookie: header value for the request, or NULL. caller frees
+char* cookiejar_header(struct cookiejar *jar, const char *host, const char *path, int https);
+
+int cookiejar_count(struct cookiejar *jar);
+
+// store a copy of c in memory immediately and queue it for the next flush.
+// an expired cookie deletes any matching one
+void cookiejar_add(struct cookiejar *jar, struct cookie *c);
+int cookiejar_pending(struct cookiejar *jar);
+
+// write queued cookies in one locked rewrite of the file, merged with any
+// changes made by other processes and compacted. returns -1 on error
+int cookiejar_flush(struct cookiejar *jar);
+
+#endif
@@ -0,0 +1,568 @@
+// downloads on the browser's own SoupSession, in parallel byte-range segments
+//
+// every download starts as one open-ended GET. once its headers show the
+// size and that the server honours ranges, the file is preallocated, that
+// request is cut short at the end of the first segment and the rest are
+// fetched with Range headers alongside it. each chunk lands with pwrite at
+// its own offset, so segments never coordinate. requests share the
+// session's connections and cookies like any page load.
+//
+// progress lives in a sidecar next to the partial file: the URI, the
+// validator, the size and each segment's range and position. a segment that
+// fails retries from where it stopped, and asking for the same URI in the
+// same place again, after a crash say, resumes from the sidecar. If-Range
+// turns a file changed in the meantime into a fresh start rather than a
+// splice of two versions.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "util.h"
+#include "download.h"
+
+// smallest segment worth its own connection
+#define MIN_SEGMENT (1 << 20)
+#define MAX_SEGMENTS 16
+// attempts per segment, with the delay doubling from RETRY_DELAY ms
+#define RETRIES 5
+#define RETRY_DELAY 500
+// ns between sidecar writes while data arrives
+#define SAVE_EVERY 2000000000ULL
+// longest sidecar line
+#define LINE 8192
+
+enum { QUEUED, RUNNING, DONE, FAILED };
+
+struct download;
+
+struct segment {
+	struct download *d;
+	goffset start, end, pos;  // end is exclusive, -1 while the size is unknown
+	SoupMessage *msg;
+	int retries;
+	int accepting;  // the current response is the one to write
+};
+
+struct download {
+	struct downloads *m;
+	char *uri, *referer, *file, *part, *state;
+	char *validator;  // ETag or Last-Modified, for If-Range
+	goffset size;     // -1 unknown
+	int fd, ranges, status, restart, restarted, failed;
+	struct segment segs[MAX_SEGMENTS];
+	int nsegs, active;
+	unsigned long long saved;
+	struct download *next;
+};
+
+struct downloads {
+	SoupSession *session;
+	char *agent;
+	int limit, segments;
+	struct download *list;
+	download_fn fn;
+	void *data;
+	guint timer;
+	guint64 bytes;  // since the last sample
+	double rate;
+	unsigned long long sampled;
+};
+
+static void start(struct download *d);
+static int request(struct segment *s);
+
+static int
+pwrite_all(int fd, const char *buf, size_t len, off_t at)
+{
+	ssize_t n;
+	while (len)
+	{
+		n = pwrite(fd, buf, len, at);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		buf += n; len -= n; at += n;
+	}
+	return 0;
+}
+static int
+seg_done(struct segment *s)
+{
+	return s->end >= 0 && s->pos >= s->end;
+}
+static void
+save_state(struct download *d)
+{
+	int i;
+	char tmp[strlen(d->state) + 8];
+	sprintf(tmp, "%s.tmp", d->state);
+	FILE *f = fopen(tmp, "w");
+	if (!f) return;
+	fprintf(f, "meme-download 1\n%s\n%s\n%lld %d\n", d->uri, d->validator ? d->validator: "-",
+		(long long)d->size, d->ranges);
+	for (i = 0; i < d->nsegs; i++)
+		fprintf(f, "%lld %lld %lld\n", (long long)d->segs[i].start, (long long)d->segs[i].end,
+			(long long)d->segs[i].pos);
+	// the data must be on disk before a sidecar that vouches for it
+	if (d->fd >= 0) fdatasync(d->fd);
+	if (fclose(f) || rename(tmp, d->state)) unlink(tmp);
+	d->saved = now_ns();
+}
+// pick up where a previous attempt at the same URI stopped
+static void
+load_state(struct download *d)
+{
+	char line[LINE], uri[LINE], validator[LINE];
+	long long size, start, end, pos;
+	int ranges;
+	struct stat st;
+	if (stat(d->part, &st)) return;
+	FILE *f = fopen(d->state, "r");
+	if (!f) return;
+
+	if (fgets(line, sizeof(line), f) && !strcmp(line, "meme-download 1\n")
+		&& fgets(uri, sizeof(uri), f) && fgets(validator, sizeof(validator), f)
+		&& fgets(line, sizeof(line), f) && sscanf(line, "%lld %d", &size, &ranges) == 2)
+	{
+		uri[strcspn(uri, "\n")] = '\0';
+		validator[strcspn(validator, "\n")] = '\0';
+		if (!strcmp(uri, d->uri))
+		{
+			while (d->nsegs < MAX_SEGMENTS && fgets(line, sizeof(line), f)
+				&& sscanf(line, "%lld %lld %lld", &start, &end, &pos) == 3)
+			{
+				struct segment *s = &d->segs[d->nsegs++];
+				s->d = d; s->start = start; s->end = end; s->pos = pos;
+			}
+			d->size = size;
+			d->ranges = ranges;
+			if (strcmp(validator, "-")) d->validator = strdup(validator);
+		}
+	}
+	fclose(f);
+	// without ranges or a validator there is nothing safe to resume
+	if (!d->ranges || !d->validator)
+	{
+		d->nsegs = 0;
+		d->size = -1;
+		free(d->validator);
+		d->validator = NULL;
+	}
+}
+static void
+notify(struct downloads *m, const char *file, int event)
+{
+	if (m->fn) m->fn(file, event, m->data);
+}
+static void
+run_queue(struct downloads *m)
+{
+	struct download *d;
+	int running = 0;
+	for (d = m->list; d; d = d->next) running += d->status == RUNNING;
+	for (d = m->list; d && running < m->limit; d = d->next)
+		if (d->status == QUEUED) { start(d); running++; }
+}
+static void
+cancel_all(struct download *d)
+{
+	int i;
+	for (i = 0; i < d->nsegs; i++)
+		if (d->segs[i].msg) soup_session_cancel_message(d->m->session, d->segs[i].msg, SOUP_STATUS_CANCELLED);
+}
+// cut the first request short, and request the rest of the file alongside
+static void
+split(struct download *d)
+{
+	struct downloads *m = d->m;
+	goffset size = d->size;
+	int i, n = size / MIN_SEGMENT;
+	if (n > m->segments) n = m->segments;
+	if (n > MAX_SEGMENTS) n = MAX_SEGMENTS;
+	if (n < 1) n = 1;
+
+	d->segs[0].end = size / n;
+	for (i = 1; i < n; i++)
+	{
+		struct segment *s = &d->segs[i];
+		memset(s, 0, sizeof(struct segment));
+		s->d = d;
+		s->start = s->pos = size * i / n;
+		s->end = size * (i+1) / n;
+	}
+	d->nsegs = n;
+	// the first request may already be past its new end
+	if (d->segs[0].pos >= d->segs[0].end) d->segs[0].pos = d->segs[0].end;
+	for (i = 1; i < n; i++) request(&d->segs[i]);
+}
+static void
+got_headers(SoupMessage *msg, gpointer data)
+{
+	struct segment *s = data;
+	struct download *d = s->d;
+	SoupMessageHeaders *h = msg->response_headers;
+	goffset start, end, total;
+
+	// a redirect or an authentication challenge has a body of its own
+	s->accepting = 0;
+	if (msg->status_code == SOUP_STATUS_PARTIAL_CONTENT)
+	{
+		if (!soup_message_headers_get_content_range(h, &start, &end, &total) || start != s->pos)
+		{
+			d->failed = 1;
+			cancel_all(d);
+			return;
+		}
+		if (d->size < 0 && total > 0) d->size = total;
+	}
+	else
+	if (msg->status_code == SOUP_STATUS_OK)
+	{
+		// a whole file where a range was asked for: the server ignores
+		// ranges or, by If-Range, the file changed. either way, start over
+		if (s->pos > 0 || d->nsegs > 1)
+		{
+			d->restart = 1;
+			cancel_all(d);
+			return;
+		}
+		d->ranges = soup_message_headers_get_one(h, "Accept-Ranges")
+			&& strstr(soup_message_headers_get_one(h, "Accept-Ranges"), "bytes");
+		if (soup_message_headers_get_encoding(h) == SOUP_ENCODING_CONTENT_LENGTH)
+			d->size = soup_message_headers_get_content_length(h);
+	}
+	else return;
+
+	if (!d->validator)
+	{
+		const char *v = soup_message_headers_get_one(h, "ETag");
+		if (!v) v = soup_message_headers_get_one(h, "Last-Modified");
+		if (v) d->validator = strdup(v);
+	}
+	s->accepting = 1;
+	if (d->size >= 0 && s->end < 0)
+	{
+		// only the first response of a fresh download gets here
+		posix_fallocate(d->fd, 0, d->size);
+		s->end = d->size;
+		if (d->ranges && d->validator && d->size >= 2 * MIN_SEGMENT) split(d);
+		save_state(d);
+	}
+}
+static void
+got_chunk(SoupMessage *msg, SoupBuffer *chunk, gpointer data)
+{
+	struct segment *s = data;
+	struct download *d = s->d;
+	goffset len = chunk->length;
+	if (!s->accepting || seg_done(s) || d->failed || d->restart) return;
+	if (s->end >= 0 && s->pos + len > s->end) len = s->end - s->pos;
+
+	if (pwrite_all(d->fd, chunk->data, len, s->pos))
+	{
+		d->failed = 1;
+		cancel_all(d);
+		return;
+	}
+	s->pos += len;
+	d->m->bytes += len;
+	if (seg_done(s) && s->msg) soup_session_cancel_message(d->m->session, msg, SOUP_STATUS_CANCELLED);
+	if (now_ns() - d->saved > SAVE_EVERY) save_state(d);
+}
+static void
+finish(struct download *d)
+{
+	struct downloads *m = d->m;
+	int i;
+	if (d->restart && !d->restarted && !d->failed)
+	{
+		d->restart = 0;
+		d->restarted = 1;
+		d->nsegs = 0;
+		d->size = -1;
+		d->ranges = 0;
+		free(d->validator);
+		d->validator = NULL;
+		if (ftruncate(d->fd, 0)) {}
+		close(d->fd);
+		d->fd = -1;
+		start(d);
+		return;
+	}
+	for (i = 0; i < d->nsegs; i++)
+		if (!seg_done(&d->segs[i])) d->failed = 1;
+
+	if (!d->failed && d->size >= 0 && (fsync(d->fd) || rename(d->part, d->file)))
+		d->failed = 1;
+	if (d->failed) save_state(d);
+	else unlink(d->state);
+
+	close(d->fd);
+	d->fd = -1;
+	d->status = d->failed ? FAILED: DONE;
+	notify(m, d->file, d->failed ? DOWNLOAD_FAILED: DOWNLOAD_DONE);
+	run_queue(m);
+}
+static gboolean
+retry_cb(gpointer data)
+{
+	struct segment *s = data;
+	struct download *d = s->d;
+	d->active--;
+	if (d->failed || d->restart || request(s))
+	{
+		d->failed |= !d->restart;
+		if (!d->active) finish(d);
+	}
+	return FALSE;
+}
+static void
+finished(SoupSession *session, SoupMessage *msg, gpointer data)
+{
+	struct segment *s = data;
+	struct download *d = s->d;
+	s->msg = NULL;
+	d->active--;
+
+	// the size was never known: the body simply ran to its end
+	if (s->end < 0 && SOUP_STATUS_IS_SUCCESSFUL(msg->status_code) && !d->failed && !d->restart)
+	{
+		d->size = s->end = s->pos;
+		if (ftruncate(d->fd, d->size)) d->failed = 1;
+	}
+	if (!seg_done(s) && !d->failed && !d->restart)
+	{
+		int transient = SOUP_STATUS_IS_TRANSPORT_ERROR(msg->status_code)
+			|| SOUP_STATUS_IS_SERVER_ERROR(msg->status_code);
+		if (transient && msg->status_code != SOUP_STATUS_CANCELLED && s->retries < RETRIES
+			&& (d->ranges || s->pos == 0))
+		{
+			// still active while the retry waits
+			d->active++;
+			g_timeout_add(RETRY_DELAY << s->retries++, retry_cb, s);
+			return;
+		}
+		d->failed = 1;
+		cancel_all(d);
+	}
+	if (!d->active) finish(d);
+}
+static int
+request(struct segment *s)
+{
+	struct download *d = s->d;
+	struct downloads *m = d->m;
+	SoupMessage *msg = soup_message_new("GET", d->uri);
+	if (!msg)
+	{
+		d->failed = 1;
+		return -1;
+	}
+	SoupMessageHeaders *h = msg->request_headers;
+	if (m->agent) soup_message_headers_replace(h, "User-Agent", m->agent);
+	if (d->referer) soup_message_headers_replace(h, "Referer", d->referer);
+	if (s->pos > 0 || s->end >= 0)
+	{
+		soup_message_headers_set_range(h, s->pos, s->end >= 0 ? s->end - 1: -1);
+		if (d->validator) soup_message_headers_replace(h, "If-Range", d->validator);
+	}
+	soup_message_body_set_accumulate(msg->response_body, FALSE);
+	s->accepting = 0;
+	g_signal_connect(msg, "got-headers", G_CALLBACK(got_headers), s);
+	g_signal_connect(msg, "got-chunk", G_CALLBACK(got_chunk), s);
+
+	d->active++;
+	s->msg = msg;
+	soup_session_queue_message(m->session, msg, finished, s);
+	return 0;
+}
+static void
+start(struct download *d)
+{
+	int i;
+	d->status = RUNNING;
+	d->fd = open(d->part, O_RDWR|O_CREAT|O_CLOEXEC, 0644);
+	// one process per partial file
+	if (d->fd < 0 || flock(d->fd, LOCK_EX|LOCK_NB))
+	{
+		if (d->fd >= 0) close(d->fd);
+		d->status = FAILED;
+		notify(d->m, d->file, DOWNLOAD_FAILED);
+		return;
+	}
+	if (!d->nsegs)
+	{
+		memset(&d->segs[0], 0, sizeof(struct segment));
+		d->segs[0].d = d;
+		d->segs[0].end = -1;
+		d->nsegs = 1;
+	}
+	for (i = 0; i < d->nsegs; i++)
+	{
+		d->segs[i].msg = NULL;
+		d->segs[i].retries = 0;
+	}
+	for (i = 0; i < d->nsegs; i++)
+		if (!seg_done(&d->segs[i])) request(&d->segs[i]);
+	if (!d->active) finish(d);
+}
+static void
+download_free(struct download *d)
+{
+	free(d->uri); free(d->referer); free(d->file); free(d->part); free(d->state);
+	free(d->validator);
+	free(d);
+}
+static gboolean
+sample_cb(gpointer data)
+{
+	struct downloads *m = data;
+	struct download *d, **p;
+	unsigned long long now = now_ns();
+	double secs = (now - m->sampled) / 1e9;
+	m->rate = m->rate * 0.5 + (secs > 0 ? m->bytes / secs: 0) * 0.5;
+	m->bytes = 0;
+	m->sampled = now;
+
+	// finished downloads were reported already, and nothing else points at
+	// them once their last request is done
+	for (p = &m->list; (d = *p); )
+	{
+		if ((d->status == DONE || d->status == FAILED) && !d->active) { *p = d->next; download_free(d); }
+		else p = &d->next;
+	}
+
+	for (d = m->list; d && d->status != RUNNING && d->status != QUEUED; d = d->next);
+	if (!d)
+	{
+		m->rate = 0;
+		m->timer = 0;
+	}
+	notify(m, NULL, DOWNLOAD_PROGRESS);
+	return m->timer != 0;
+}
+struct downloads*
+downloads_new(SoupSession *session, const char *agent, int limit, int segments, download_fn fn, void *data)
+{
+	struct downloads *m = calloc(1, sizeof(struct downloads));
+	m->session = session;
+	m->agent = agent ? strdup(agent): NULL;
+	m->limit = limit > 0 ? limit: 1;
+	m->segments = segments > 0 ? segments: 1;
+	m->fn = fn;
+	m->data = data;
+	return m;
+}
+static int
+taken(struct downloads *m, const char *file)
+{
+	struct download *d;
+	for (d = m->list; d; d = d->next)
+		if ((d->status == RUNNING || d->status == QUEUED) && !strcmp(d->file, file)) return 1;
+	return 0;
+}
+int
+download_add(struct downloads *m, const char *uri, const char *referer, const char *dir, const char *name)
+{
+	struct download *d = calloc(1, sizeof(struct download));
+	d->m = m;
+	d->uri = strdup(uri);
+	d->referer = referer ? strdup(referer): NULL;
+	d->size = -1;
+	d->fd = -1;
+
+	// name, then name.1, name.2... skipping finished files, but not partial
+	// downloads of this same URI, which resume
+	int i;
+	const char *base = name && *name && !strchr(name, '/') ? name: "download";
+	for (i = 0; i < 1000; i++)
+	{
+		free(d->file); free(d->part); free(d->state);
+		size_t len = strlen(dir) + strlen(base) + 32;
+		d->file = malloc(len); d->part = malloc(len); d->state = malloc(len);
+		if (i) snprintf(d->file, len, "%s/%s.%d", dir, base, i);
+		else snprintf(d->file, len, "%s/%s", dir, base);
+		snprintf(d->part, len, "%s.part", d->file);
+		snprintf(d->state, len, "%s.meme", d->file);
+		if (taken(m, d->file) || !access(d->file, F_OK)) continue;
+		load_state(d);
+		if (d->nsegs || access(d->part, F_OK)) break;
+	}
+	d->next = m->list;
+	m->list = d;
+	d->status = QUEUED;
+	if (!m->timer)
+	{
+		m->sampled = now_ns();
+		m->timer = g_timeout_add(1000, sample_cb, m);
+	}
+	run_queue(m);
+	return d->status == FAILED ? -1: 0;
+}
+void
+downloads_status(struct downloads *m, int *running, int *queued, double *rate, double *fraction)
+{
+	struct download *d;
+	goffset size = 0, done = 0;
+	int i;
+	*running = *queued = 0;
+	for (d = m->list; d; d = d->next)
+	{
+		if (d->status == QUEUED) (*queued)++;
+		if (d->status != RUNNING) continue;
+		(*running)++;
+		if (d->size <= 0) continue;
+		size += d->size;
+		for (i = 0; i < d->nsegs; i++) done += d->segs[i].pos - d->segs[i].start;
+	}
+	*rate = m->rate;
+	*fraction = size ? (double)done / size: -1;
+}
+void
+downloads_save(struct downloads *m, const char *list)
+{
+	struct download *d;
+	FILE *f = NULL;
+	for (d = m->list; d; d = d->next)
+	{
+		if (d->status == RUNNING) save_state(d);
+		if (!list || (d->status != RUNNING && d->status != QUEUED)) continue;
+		// other processes append theirs at exit too
+		if (!f && !(f = fopen(list, "a"))) return;
+		fprintf(f, "%s\t%s\t%s\n", d->uri, d->referer ? d->referer: "-", d->file);
+		fflush(f);
+	}
+	if (f) fclose(f);
+}
+int
+downloads_resume(struct downloads *m, const char *list)
+{
+	char line[3 * LINE], tmp[strlen(list) + 32];
+	int n = 0;
+	// renamed first, so only one process takes each list
+	snprintf(tmp, sizeof(tmp), "%s.%d", list, (int)getpid());
+	if (rename(list, tmp)) return 0;
+	FILE *f = fopen(tmp, "r");
+	unlink(tmp);
+	if (!f) return 0;
+	while (fgets(line, sizeof(line), f))
+	{
+		char *uri = line, *referer, *file, *name, part[LINE + 8];
+		line[strcspn(line, "\n")] = '\0';
+		if (!(referer = strchr(uri, '\t')) || !(file = strchr(++referer, '\t'))) continue;
+		*file++ = '\0';
+		referer[-1] = '\0';
+		if (!(name = strrchr(file, '/')) || strlen(file) > LINE) continue;
+		// finished by someone else meanwhile
+		snprintf(part, sizeof(part), "%s.part", file);
+		if (!access(file, F_OK) && access(part, F_OK)) continue;
+		*name++ = '\0';
+		if (!download_add(m, uri, strcmp(referer, "-") ? referer: NULL, *file ? file: "/", name)) n++;
+	}
+	fclose(f);
+	return n;
+}
@@ -0,0 +1,36 @@
+// downloads on the browser's own SoupSession, in parallel byte-range segments
+
+#ifndef MEME_DOWNLOAD_H
+#define MEME_DOWNLOAD_H
+
+#include <libsoup/soup.h>
+
+struct downloads;
+
+enum { DOWNLOAD_PROGRESS, DOWNLOAD_DONE, DOWNLOAD_FAILED };
+
+// DOWNLOAD_PROGRESS about once a second while anything runs, with a NULL
+// file. DOWNLOAD_DONE or DOWNLOAD_FAILED once per download
+typedef void (*download_fn)(const char *file, int event, void *data);
+
+// at most limit downloads run at once, each in at most segments requests
+struct downloads* downloads_new(SoupSession *session, const char *agent, int limit, int segments,
+	download_fn fn, void *data);
+
+// fetch uri into dir, named name or name.N if that is taken. a partial
+// download of the same uri under that name is resumed
+int download_add(struct downloads *m, const char *uri, const char *referer, const char *dir, const char *name);
+
+// running and queued downloads, bytes per second lately, and the fraction
+// done of those whose size is known (-1 if none)
+void downloads_status(struct downloads *m, int *running, int *queued, double *rate, double *fraction);
+
+// record every running download's progress so asking again resumes it,
+// and append each unfinished one to list, if not NULL
+void downloads_save(struct downloads *m, const char *list);
+
+// ask again for the downloads saved to list, and empty it. the number
+// started or queued
+int downloads_resume(struct downloads *m, const char *list);
+
+#endif
@@ -0,0 +1,316 @@
+// visit history with frecency scores, backed by an append-only log
+//
+// each line of the log is "time score uri". a visit appends "time 1 uri" as
+// one O_APPEND write under flock, so several processes can log at once. a
+// URI's frecency is the sum of its visit scores, each decayed exponentially
+// by age. that is kept incrementally as a score decayed to the last visit,
+// so applying a record is O(1) and a sync only reads the log's new tail.
+//
+// compaction folds the log to one record per URI carrying the decayed sum.
+// it reads and writes everything unlocked, then takes the lock only to copy
+// across any tail appended meanwhile and rename the result into place.
+// appenders that were waiting on the old file notice it was unlinked and
+// reopen, so no visit is lost.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "util.h"
+#include "history.h"
+
+struct visit {
+	char *uri;
+	unsigned int hash;
+	double score;  // decayed to last
+	long long last;
+	struct visit *next;
+};
+
+struct table {
+	struct visit **visits;
+	unsigned int width, count;
+};
+
+struct history {
+	char *file;
+	double lambda;
+	struct table table;
+	int synced;
+	dev_t dev;
+	ino_t ino;
+	off_t offset;
+	long records;
+};
+
+static void
+table_init(struct table *t)
+{
+	t->width = 1024;
+	t->count = 0;
+	t->visits = calloc(t->width, sizeof(struct visit*));
+}
+static void
+table_clear(struct table *t)
+{
+	unsigned int i;
+	for (i = 0; i < t->width; i++)
+	{
+		struct visit *v = t->visits[i], *n;
+		for (; v; v = n) { n = v->next; free(v->uri); free(v); }
+		t->visits[i] = NULL;
+	}
+	t->count = 0;
+}
+static struct visit*
+table_find(struct table *t, const char *uri, int create)
+{
+	unsigned int hash = hash_str(uri), i;
+	struct visit *v;
+	for (v = t->visits[hash & (t->width-1)]; v; v = v->next)
+		if (v->hash == hash && !strcmp(v->uri, uri)) return v;
+	if (!create) return NULL;
+
+	if (t->count >= t->width)
+	{
+		unsigned int width = t->width * 2;
+		struct visit **visits = calloc(width, sizeof(struct visit*)), *n;
+		for (i = 0; i < t->width; i++)
+		{
+			for (v = t->visits[i]; v; v = n)
+			{
+				n = v->next;
+				v->next = visits[v->hash & (width-1)];
+				visits[v->hash & (width-1)] = v;
+			}
+		}
+		free(t->visits);
+		t->visits = visits;
+		t->width = width;
+	}
+	v = calloc(1, sizeof(struct visit));
+	v->uri = strdup(uri);
+	v->hash = hash;
+	v->next = t->visits[hash & (t->width-1)];
+	t->visits[hash & (t->width-1)] = v;
+	t->count++;
+	return v;
+}
+// records from other processes may arrive slightly out of time order
+static void
+apply(struct visit *v, long long when, double score, double lambda)
+{
+	if (!v->last) { v->score = score; v->last = when; }
+	else if (when <= v->last) v->score += score * exp(-lambda * (v->last - when));
+	else
+	{
+		v->score = v->score * exp(-lambda * (when - v->last)) + score;
+		v->last = when;
+	}
+}
+static double
+current(struct visit *v, double lambda, long long now)
+{
+	return now > v->last ? v->score * exp(-lambda * (now - v->last)): v->score;
+}
+// parse whole lines from buf, returning the bytes consumed
+static size_t
+parse(struct table *t, char *buf, size_t len, double lambda, long *records, history_fn fn, void *data)
+{
+	char *line = buf, *p, *end;
+	long long now = time(NULL);
+	while (line < buf+len && (p = memchr(line, '\n', buf+len-line)))
+	{
+		*p = '\0';
+		long long when = strtoll(line, &end, 10);
+		double score = strtod(end, &end);
+		if (*end == ' ' && end[1])
+		{
+			struct visit *v = table_find(t, end+1, 1);
+			apply(v, when, score, lambda);
+			(*records)++;
+			if (fn) fn(v->uri, current(v, lambda, now), data);
+		}
+		line = p+1;
+	}
+	return line - buf;
+}
+static char*
+read_range(int fd, off_t from, off_t to)
+{
+	char *buf = malloc(to - from + 1);
+	ssize_t n;
+	off_t len = 0;
+	while (from + len < to && (n = pread(fd, buf+len, to-from-len, from+len)) > 0) len += n;
+	buf[len] = '\0';
+	return buf;
+}
+struct history*
+history_new(const char *file, double halflife)
+{
+	struct history *h = calloc(1, sizeof(struct history));
+	h->file = strdup(file);
+	h->lambda = log(2) / halflife;
+	table_init(&h->table);
+	return h;
+}
+void
+history_free(struct history *h)
+{
+	if (!h) return;
+	table_clear(&h->table);
+	free(h->table.visits);
+	free(h->file);
+	free(h);
+}
+int
+history_sync(struct history *h, history_fn fn, void *data)
+{
+	struct stat st;
+	int fd = open(h->file, O_RDONLY);
+	if (fd < 0) { h->synced = 1; return 0; }
+	if (fstat(fd, &st)) { close(fd); return -1; }
+
+	// a compaction replaced the file: start over
+	int full = !h->synced || st.st_dev != h->dev || st.st_ino != h->ino || st.st_size < h->offset;
+	if (full)
+	{
+		table_clear(&h->table);
+		h->offset = 0;
+		h->records = 0;
+	}
+	if (st.st_size > h->offset)
+	{
+		char *buf = read_range(fd, h->offset, st.st_size);
+		h->offset += parse(&h->table, buf, st.st_size - h->offset, h->lambda, &h->records,
+			full ? NULL: fn, data);
+		free(buf);
+	}
+	close(fd);
+
+	if (full && fn) history_each(h, fn, data);
+	h->synced = 1;
+	h->dev = st.st_dev;
+	h->ino = st.st_ino;
+	return 0;
+}
+int
+history_visit(struct history *h, const char *uri, history_fn fn, void *data)
+{
+	if (!*uri || strchr(uri, '\n')) return 0;
+
+	size_t n = strlen(uri) + 32;
+	char *line = malloc(n);
+	n = snprintf(line, n, "%lld 1 %s\n", (long long)time(NULL), uri);
+
+	struct stat st;
+	int fd, tries, rc = -1;
+	for (tries = 0; tries < 3; tries++)
+	{
+		if ((fd = open(h->file, O_WRONLY|O_APPEND|O_CREAT, 0644)) < 0) break;
+		flock(fd, LOCK_EX);
+		// unlinked if compacted and renamed over while we waited
+		int live = !fstat(fd, &st) && st.st_nlink > 0;
+		if (live) rc = write(fd, line, n) == (ssize_t)n ? 0: -1;
+		flock(fd, LOCK_UN);
+		close(fd);
+		if (live) break;
+	}
+	free(line);
+	if (!rc && h->synced) history_sync(h, fn, data);
+	return rc;
+}
+void
+history_each(struct history *h, history_fn fn, void *data)
+{
+	unsigned int i;
+	long long now = time(NULL);
+	struct visit *v;
+	for (i = 0; i < h->table.width; i++)
+		for (v = h->table.visits[i]; v; v = v->next)
+			fn(v->uri, current(v, h->lambda, now), data);
+}
+double
+history_score(struct history *h, const char *uri)
+{
+	struct visit *v = table_find(&h->table, uri, 0);
+	return v ? current(v, h->lambda, time(NULL)): 0.0;
+}
+int
+history_count(struct history *h)
+{
+	return h->table.count;
+}
+int
+history_bloated(struct history *h)
+{
+	return h->records > 2 * (long)h->table.count + 1024;
+}
+static int
+write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+	while (len && (n = write(fd, buf, len)) > 0) { buf += n; len -= n; }
+	return len ? -1: 0;
+}
+int
+history_compact(const char *file, double halflife)
+{
+	struct stat st;
+	struct table t;
+	long records = 0;
+	double lambda = log(2) / halflife;
+
+	int fd = open(file, O_RDONLY);
+	if (fd < 0) return -1;
+	if (fstat(fd, &st)) { close(fd); return -1; }
+
+	table_init(&t);
+	char *buf = read_range(fd, 0, st.st_size);
+	off_t done = parse(&t, buf, st.st_size, lambda, &records, NULL, NULL);
+	free(buf);
+
+	char tmp[strlen(file) + 32];
+	snprintf(tmp, sizeof(tmp), "%s.%d", file, (int)getpid());
+	int out = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	int rc = out < 0 ? -1: 0;
+
+	unsigned int i;
+	struct visit *v;
+	char line[64];
+	for (i = 0; !rc && i < t.width; i++)
+	{
+		for (v = t.visits[i]; !rc && v; v = v->next)
+		{
+			snprintf(line, sizeof(line), "%lld %.6g ", v->last, v->score);
+			rc = write_all(out, line, strlen(line)) || write_all(out, v->uri, strlen(v->uri))
+				|| write_all(out, "\n", 1);
+		}
+	}
+	table_clear(&t);
+	free(t.visits);
+
+	if (!rc)
+	{
+		flock(fd, LOCK_EX);
+		// lost a race with another compactor
+		if (fstat(fd, &st) || !st.st_nlink) rc = -1;
+		if (!rc && st.st_size > done)
+		{
+			buf = read_range(fd, done, st.st_size);
+			rc = write_all(out, buf, st.st_size - done);
+			free(buf);
+		}
+		if (!rc) rc = fsync(out) || rename(tmp, file);
+		flock(fd, LOCK_UN);
+	}
+	if (out >= 0) close(out);
+	if (rc) unlink(tmp);
+	close(fd);
+	return rc ? -1: 0;
+}
@@ -0,0 +1,35 @@
+// visit history with frecency scores, backed by an append-only log
+
+#ifndef MEME_HISTORY_H
+#define MEME_HISTORY_H
+
+struct history;
+
+// called for each URI whose score changed during a sync
+typedef void (*history_fn)(const char *uri, double score, void *data);
+
+// halflife in seconds: a visit that old counts half as much as one now
+struct history* history_new(const char *file, double halflife);
+void history_free(struct history *h);
+
+// apply records appended since the last sync, by any process. the first
+// sync, and the first after a compaction, reads the whole log
+int history_sync(struct history *h, history_fn fn, void *data);
+
+// append a visit. once synced, the visit is applied with the sync it triggers
+int history_visit(struct history *h, const char *uri, history_fn fn, void *data);
+
+// call fn once for every URI, with its score now
+void history_each(struct history *h, history_fn fn, void *data);
+
+double history_score(struct history *h, const char *uri);
+int history_count(struct history *h);
+
+// true when the log holds enough superseded records to be worth compacting
+int history_bloated(struct history *h);
+
+// rewrite the log with one aggregate record per URI. touches only the file,
+// so it may run on another thread or process while visits are appended
+int history_compact(const char *file, double halflife);
+
+#endif
@@ -0,0 +1,75 @@
+// what the navbar's text and the key bindings ask for, decided without GTK
+//
+// kept apart from meme.c so it can be benchmarked and checked without a
+// display. a search term is percent-encoded byte by byte, so UTF-8 goes
+// through intact, and nothing is written past the caller's buffer however
+// long the text.
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "input.h"
+
+static const char *action_names[ACTIONS] = {
+	"go-home", "go-back", "go-forward", "zoom-in", "zoom-out",
+	"zoom-reset", "toggle-source", "reload-nocache", "run-scriptfile",
+	"focus-navbar", "new-window", "print-page", "find-text",
+	"bookmark-page", "link-hints",
+};
+
+// percent-encode all but letters and digits. -1 if it won't fit
+static int
+escape(const char *s, char *out, size_t len)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	size_t i = 0;
+	const unsigned char *p;
+	for (p = (const unsigned char*)s; *p; p++)
+	{
+		if (i + 4 > len) return -1;
+		if (isalnum(*p)) out[i++] = *p;
+		else
+		{
+			out[i++] = '%';
+			out[i++] = hex[*p >> 4];
+			out[i++] = hex[*p & 15];
+		}
+	}
+	if (i >= len) return -1;
+	out[i] = '\0';
+	return 0;
+}
+int
+entry_classify(const char *text, const char *search, char *out, size_t len)
+{
+	char tmp[len];
+	int n;
+	if (text[0] == '/') return ENTRY_FIND;
+	if (text[0] == '!') return ENTRY_COMMAND;
+	if (!strcmp(text, "about:bookmarks")) return ENTRY_BOOKMARKS;
+	// a non-fqdn is a search term
+	if (!strstr(text, "localhost") && (strchr(text, ' ') || !strchr(text, '.')))
+	{
+		if (escape(text, tmp, len)) return -1;
+		n = snprintf(out, len, search, tmp);
+		return n < 0 || (size_t)n >= len ? -1: ENTRY_SEARCH;
+	}
+	n = snprintf(out, len, "%s%s", strstr(text, "://") ? "": "http://", text);
+	return n < 0 || (size_t)n >= len ? -1: ENTRY_URI;
+}
+int
+key_action_find(const char *name)
+{
+	int i;
+	for (i = 0; i < ACTIONS; i++)
+		if (!strcmp(name, action_names[i])) return i;
+	return -1;
+}
+int
+key_find(const struct keycontrol *keys, unsigned int mod, unsigned int key)
+{
+	int i;
+	for (i = 0; keys[i].action; i++)
+		if (keys[i].mod == mod && keys[i].key == key) return i;
+	return -1;
+}
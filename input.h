@@ -0,0 +1,35 @@
+// what the navbar's text and the key bindings ask for, decided without GTK
+
+#ifndef MEME_INPUT_H
+#define MEME_INPUT_H
+
+#include <stddef.h>
+
+struct keycontrol {
+	unsigned int mod;
+	unsigned int key;
+	char *action;
+};
+
+enum { ENTRY_FIND, ENTRY_COMMAND, ENTRY_BOOKMARKS, ENTRY_SEARCH, ENTRY_URI };
+
+// classify text typed into the navbar. for ENTRY_SEARCH and ENTRY_URI the
+// URI to load is written to out, a search through search, a printf format
+// with one %s. -1 if that URI would not fit in len
+int entry_classify(const char *text, const char *search, char *out, size_t len);
+
+enum {
+	ACTION_GO_HOME, ACTION_GO_BACK, ACTION_GO_FORWARD, ACTION_ZOOM_IN, ACTION_ZOOM_OUT,
+	ACTION_ZOOM_RESET, ACTION_TOGGLE_SOURCE, ACTION_RELOAD_NOCACHE, ACTION_RUN_SCRIPTFILE,
+	ACTION_FOCUS_NAVBAR, ACTION_NEW_WINDOW, ACTION_PRINT_PAGE, ACTION_FIND_TEXT,
+	ACTION_BOOKMARK_PAGE, ACTION_LINK_HINTS, ACTIONS
+};
+
+// the ACTION_ called name, such as "go-home", or -1
+int key_action_find(const char *name);
+
+// the index of the binding for mod and key in keys, which ends with a NULL
+// action, or -1
+int key_find(const struct keycontrol *keys, unsigned int mod, unsigned int key);
+
+#endif
@@ -0,0 +1,347 @@
+// runs commands from a helper process forked before the browser grows
+//
+// fork() from a process with WebKit loaded copies its page tables and then
+// takes copy-on-write faults in the parent, stalling the main loop for each
+// download or window. the helper is forked first thing in main, while the
+// address space is still small, and does every later fork on its behalf.
+//
+// requests and exit statuses travel over one socketpair. a request is
+// (id, argc, envc, then argc arguments and envc NAME=value entries, each a
+// length-prefixed string); a reply is (id, status). the entries join the
+// child's environment, since the helper's own was copied at fork.
+// the helper reaps its children with a self-pipe woken from SIGCHLD, and
+// exits when the browser closes its end. should the helper die, commands
+// fall back to posix_spawnp, which doesn't copy the parent either, but
+// their exit status goes unreported.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include "launcher.h"
+
+extern char **environ;
+
+// sanity limits on a request
+#define MAX_ARGS 1024
+#define MAX_ARG (1 << 20)
+
+struct job {
+	uint32_t id;
+	launcher_fn fn;
+	void *data;
+	struct job *next;
+};
+
+struct launcher {
+	int fd;
+	pid_t pid;
+	uint32_t next_id;
+	struct job *jobs;
+	unsigned char buf[8];
+	size_t have;
+};
+
+static int
+read_full(int fd, void *buf, size_t len)
+{
+	ssize_t n;
+	while (len)
+	{
+		n = read(fd, buf, len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		buf = (char*)buf + n;
+		len -= n;
+	}
+	return 0;
+}
+static int
+send_full(int fd, const void *buf, size_t len)
+{
+	ssize_t n;
+	while (len)
+	{
+		// MSG_NOSIGNAL: a dead peer is an error, not SIGPIPE
+		n = send(fd, buf, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		buf = (const char*)buf + n;
+		len -= n;
+	}
+	return 0;
+}
+static int
+wait_status(int status)
+{
+	if (WIFEXITED(status)) return WEXITSTATUS(status);
+	if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+	return -1;
+}
+
+// the helper side
+
+static int wake[2];
+
+static void
+helper_sigchld(int sig)
+{
+	int e = errno;
+	if (write(wake[1], "", 1) < 0) {}
+	errno = e;
+}
+static void
+helper_reply(int fd, uint32_t id, int status)
+{
+	int32_t msg[2] = { id, status };
+	send_full(fd, msg, sizeof(msg));
+}
+// read one request and start it. -1 when the browser has gone
+static int
+helper_request(int fd, pid_t **pids, uint32_t **ids, size_t *count, size_t *size)
+{
+	uint32_t head[3], len, i, n;
+	if (read_full(fd, head, sizeof(head)) || head[1] > MAX_ARGS || head[2] > MAX_ARGS) return -1;
+
+	// the arguments, a NULL, then the environment entries and a NULL
+	char **argv = calloc(head[1] + head[2] + 2, sizeof(char*)), **env = argv + head[1] + 1;
+	int rc = 0;
+	for (i = 0; !rc && i < head[1] + head[2]; i++)
+	{
+		n = i < head[1] ? i: i + 1;
+		if (read_full(fd, &len, sizeof(len)) || len > MAX_ARG) { rc = -1; break; }
+		argv[n] = malloc(len + 1);
+		rc = read_full(fd, argv[n], len);
+		argv[n][len] = '\0';
+	}
+	if (!rc && !head[1]) helper_reply(fd, head[0], 127);
+	else
+	if (!rc)
+	{
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			signal(SIGCHLD, SIG_DFL);
+			setsid();
+			for (i = 0; env[i]; i++) putenv(env[i]);
+			execvp(argv[0], argv);
+			_exit(127);
+		}
+		if (pid < 0) helper_reply(fd, head[0], 127);
+		else
+		{
+			if (*count == *size)
+			{
+				*size = *size ? *size * 2: 16;
+				*pids = realloc(*pids, *size * sizeof(pid_t));
+				*ids = realloc(*ids, *size * sizeof(uint32_t));
+			}
+			(*pids)[*count] = pid;
+			(*ids)[*count] = head[0];
+			(*count)++;
+		}
+	}
+	for (i = 0; i < head[1] + head[2] + 1; i++) free(argv[i]);
+	free(argv);
+	return rc;
+}
+static void
+helper(int fd)
+{
+	pid_t *pids = NULL, pid;
+	uint32_t *ids = NULL;
+	size_t count = 0, size = 0, i;
+	int status;
+	char drain[64];
+
+	if (pipe(wake)) _exit(1);
+	fcntl(wake[0], F_SETFL, O_NONBLOCK);
+	fcntl(wake[1], F_SETFL, O_NONBLOCK);
+	fcntl(wake[0], F_SETFD, FD_CLOEXEC);
+	fcntl(wake[1], F_SETFD, FD_CLOEXEC);
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = helper_sigchld;
+	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigaction(SIGCHLD, &sa, NULL);
+	signal(SIGINT, SIG_IGN);
+
+	struct pollfd p[2] = { { fd, POLLIN, 0 }, { wake[0], POLLIN, 0 } };
+	for (;;)
+	{
+		if (poll(p, 2, -1) < 0)
+		{
+			if (errno == EINTR) continue;
+			break;
+		}
+		if (p[1].revents)
+		{
+			while (read(wake[0], drain, sizeof(drain)) > 0);
+			while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+			{
+				for (i = 0; i < count && pids[i] != pid; i++);
+				if (i == count) continue;
+				helper_reply(fd, ids[i], wait_status(status));
+				pids[i] = pids[--count];
+				ids[i] = ids[count];
+			}
+		}
+		// the browser exited: its commands carry on without us
+		if (p[0].revents && helper_request(fd, &pids, &ids, &count, &size)) break;
+	}
+	_exit(0);
+}
+
+// the browser side
+
+struct launcher*
+launcher_new()
+{
+	struct launcher *l = calloc(1, sizeof(struct launcher));
+	int sv[2];
+	l->fd = -1;
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv)) return l;
+
+	l->pid = fork();
+	if (l->pid == 0)
+	{
+		close(sv[0]);
+		helper(sv[1]);
+	}
+	close(sv[1]);
+	if (l->pid < 0) close(sv[0]);
+	else l->fd = sv[0];
+	return l;
+}
+static void
+fail_jobs(struct launcher *l)
+{
+	struct job *j, *n;
+	for (j = l->jobs; j; j = n)
+	{
+		n = j->next;
+		if (j->fn) j->fn(-1, j->data);
+		free(j);
+	}
+	l->jobs = NULL;
+}
+static void
+helper_gone(struct launcher *l)
+{
+	close(l->fd);
+	l->fd = -1;
+	fail_jobs(l);
+}
+void
+launcher_free(struct launcher *l)
+{
+	if (!l) return;
+	// the helper sees EOF and exits
+	if (l->fd >= 0) close(l->fd);
+	l->fd = -1;
+	fail_jobs(l);
+	free(l);
+}
+int
+launcher_fd(struct launcher *l)
+{
+	return l->fd;
+}
+// each string length-prefixed, after what is already in msg
+static size_t
+pack(char *msg, size_t used, const char **strs)
+{
+	uint32_t i, len;
+	for (i = 0; strs && strs[i]; i++)
+	{
+		len = strlen(strs[i]);
+		memcpy(msg + used, &len, 4);
+		memcpy(msg + used + 4, strs[i], len);
+		used += 4 + len;
+	}
+	return used;
+}
+int
+launcher_spawn(struct launcher *l, const char **argv, const char **env, launcher_fn fn, void *data)
+{
+	uint32_t i, argc = 0, envc = 0;
+	size_t size = 12;
+	while (argv[argc]) size += 4 + strlen(argv[argc++]);
+	while (env && env[envc]) size += 4 + strlen(env[envc++]);
+
+	if (l->fd >= 0)
+	{
+		char *msg = malloc(size);
+		uint32_t head[3] = { ++l->next_id, argc, envc };
+		memcpy(msg, head, 12);
+		int rc = send_full(l->fd, msg, pack(msg, pack(msg, 12, argv), env));
+		free(msg);
+		if (!rc)
+		{
+			struct job *j = malloc(sizeof(struct job));
+			j->id = head[0];
+			j->fn = fn;
+			j->data = data;
+			j->next = l->jobs;
+			l->jobs = j;
+			return 0;
+		}
+		helper_gone(l);
+	}
+
+	// env first, so its entries win over any of the same name
+	size_t n = 0;
+	while (environ[n]) n++;
+	char **envp = malloc((envc + n + 1) * sizeof(char*));
+	for (i = 0; i < envc; i++) envp[i] = (char*)env[i];
+	memcpy(envp + envc, environ, (n + 1) * sizeof(char*));
+
+	pid_t pid;
+	posix_spawnattr_t attr;
+	posix_spawnattr_init(&attr);
+#ifdef POSIX_SPAWN_SETSID
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID);
+#endif
+	int rc = posix_spawnp(&pid, argv[0], NULL, &attr, (char* const*)argv, envp);
+	posix_spawnattr_destroy(&attr);
+	free(envp);
+	if (rc) return -1;
+	if (fn) fn(-1, data);
+	return 0;
+}
+int
+launcher_dispatch(struct launcher *l)
+{
+	if (l->fd < 0) return -1;
+	ssize_t n;
+	for (;;)
+	{
+		n = recv(l->fd, l->buf + l->have, sizeof(l->buf) - l->have, MSG_DONTWAIT);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+		if (n <= 0) { helper_gone(l); return -1; }
+
+		l->have += n;
+		if (l->have < sizeof(l->buf)) continue;
+		l->have = 0;
+
+		int32_t msg[2];
+		memcpy(msg, l->buf, sizeof(msg));
+		struct job **p = &l->jobs, *j;
+		while (*p && (*p)->id != (uint32_t)msg[0]) p = &(*p)->next;
+		if (!(j = *p)) continue;
+		*p = j->next;
+		if (j->fn) j->fn(msg[1], j->data);
+		free(j);
+	}
+}
@@ -0,0 +1,28 @@
+// runs commands from a helper process forked before the browser grows
+
+#ifndef MEME_LAUNCHER_H
+#define MEME_LAUNCHER_H
+
+struct launcher;
+
+// called once per command: its exit status, 128+signal if killed, 127 if it
+// could not be executed, or -1 if started but the status can't be known
+typedef void (*launcher_fn)(int status, void *data);
+
+// fork the helper. call first thing, while the process is still small
+struct launcher* launcher_new();
+void launcher_free(struct launcher *l);
+
+// run argv in a new session, with env's NAME=value entries, if any, added to
+// its environment. returns -1, without calling fn, if the command could not
+// be started at all
+int launcher_spawn(struct launcher *l, const char **argv, const char **env, launcher_fn fn, void *data);
+
+// readable when statuses are waiting for launcher_dispatch. -1 once the
+// helper is gone and commands are started directly
+int launcher_fd(struct launcher *l);
+
+// report finished commands. returns -1 when the helper has gone away
+int launcher_dispatch(struct launcher *l);
+
+#endif
@@ -39,369 +39,1510 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <malloc.h>
 #include <webkit/webkit.h>
+#define LIBSOUP_USE_UNSTABLE_REQUEST_API
+#include <libsoup/soup-cache.h>
 #include <glib/gstdio.h>
 #include <JavaScriptCore/JavaScript.h>
+#include <fcntl.h>
 #include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "util.h"
+#include "stats.h"
+#include "cookies.h"
+#include "bookmarks.h"
+#include "complete.h"
+#include "history.h"
+#include "launcher.h"
+#include "download.h"
+#include "block.h"
+#include "policy.h"
+#include "memory.h"
+#include "trace.h"
+#include "archive.h"
+#include "netem.h"
+#include "input.h"
 
-static GtkWidget *main_window;
-static WebKitWebView *web_view;
-static WebKitWebSettings *web_settings;
-static WebKitWebInspector *web_inspector;
-static GtkWidget* uri_entry;
-static GtkEntryCompletion *uri_completion;
-static GtkListStore *uri_model;
-static GtkTreeIter uri_iter;
+struct hint {
+	WebKitDOMElement *element;
+	glong x, y;
+};
+
+struct page;
+
+// one browser window. several share the process in single-process mode
+struct browser {
+	GtkWidget *window;
+	WebKitWebView *view;
+	GtkWidget *scroll;  // the view's scrolled window
+	WebKitWebSettings *settings;
+	GtkWidget *entry;
+	GtkEntryCompletion *completion;
+	GtkListStore *matches;
+	gchar *title;
+	gdouble progress;
+	gboolean onload_injected;
+	unsigned long long opened;  // when the window was asked for, until first paint
+	gboolean committed;
+	gboolean provisional;  // a load started that has not committed yet
+	GArray *hints;
+	GString *hint_keys;
+	gboolean block;
+	int blocked;      // requests blocked on this page
+	gchar *host;      // of this page, for third-party rules
+	struct policy forced;  // settings from ! commands, over the site's
+	struct page *page;     // the latest page load, for !stats
+};
+static GList *browsers;
 
-static gchar* main_title;
-static gdouble load_progress;
+static struct completion *uri_index;
+static struct meter completion_meter = METER("completion match", "ns");
+static struct bookmarks *bookmarks;
+static GFileMonitor *bookmark_monitor;
+static struct meter bookmark_add_meter = METER("bookmark add", "ns");
+static guint bookmark_flush_id;
+static struct history *history;
+static gboolean history_loaded;  // until then history only appends visits
+static gint history_compacting;
+static struct meter history_visit_meter = METER("history visit", "ns");
+
+static struct cookiejar *cookie_jar;
+static struct meter cookie_lookup_meter = METER("cookie lookup", "ns");
+static struct meter cookie_reload_meter = METER("cookie reload", "ns");
+static struct meter cookie_flush_meter = METER("cookie flush", "ns");
+static guint cookie_flush_id;
+static gboolean flag_verbose = FALSE;
+static gboolean flag_timing = FALSE;
+static int control_fd = -1;
+static struct meter first_paint_meter = METER("first paint", "ns");
+static struct launcher *launcher;
+static struct meter spawn_meter = METER("spawn", "ns");
+static struct downloads *downloads;
+static struct blocker *blocker;
+static struct meter block_load_meter = METER("block lists load", "ns");
+static struct meter block_check_meter = METER("block check", "ns");
+static struct policies *policies;
+static struct meter policy_meter = METER("policy lookup", "ns");
+static struct memory *memory;
+static struct archive *recording, *replaying;
+static SoupServer *replay_server;
+static struct netem netem;
+static struct meter netem_meter = METER("netem hold", "ns");
+static struct meter record_meter = METER("record", "bytes");
+static struct meter replay_hit_meter = METER("replay hit", "bytes");
+static struct meter replay_miss_meter = METER("replay miss", "requests");
+static int requests_active;
+struct bench;
+static struct bench *bench;
+static struct meter request_meter = METER("request", "ns");
+static struct meter request_dns_meter = METER("request dns", "ns");
+static struct meter request_connect_meter = METER("request connect", "ns");
+static struct meter request_ttfb_meter = METER("request ttfb", "ns");
+static struct meter request_transfer_meter = METER("request transfer", "ns");
+static struct meter page_load_meter = METER("page commit to onload", "ns");
+static struct meter page_requests_meter = METER("page requests", "requests");
+static struct meter page_bytes_meter = METER("page bytes", "bytes");
+static struct meter page_hosts_meter = METER("page host concurrency", "requests");
+static struct meter memory_trim_meter = METER("memory trim", "ns");
+static SoupCache *http_cache;
+static int http_cache_lock = -1;
+static struct meter cache_hit_meter = METER("cache hit", "bytes");
+static struct meter cache_revalidated_meter = METER("cache revalidated", "bytes");
+static struct meter cache_miss_meter = METER("cache miss", "bytes");
 
 #define BLOCK 1024
 
-struct keycontrol {
-	unsigned int mod;
-	unsigned int key;
-	char *action;
-};
+static char trace_file[BLOCK];
+
+enum { INJECT_ALL_FRAMES, INJECT_MAIN_FRAME, INJECT_LAZY };
 
 #include "config.h"
 
+// only the launcher's helper and its fallback children are ours to reap
 void
 sigchld(int unused)
 {
-	if(signal(SIGCHLD, sigchld) == SIG_ERR)
-	{
-		printf("Can't install SIGCHLD handler");
-		exit(-1);
-	}
 	while(0 < waitpid(-1, NULL, WNOHANG));
 }
+// a command started, until the launcher reports its status
+struct spawned {
+	gchar *line;
+	gboolean traced;  // its span began in the trace
+};
+static void
+spawned_free(struct spawned *s)
+{
+	g_free(s->line);
+	g_free(s);
+}
+static void
+spawn_done(int status, void *data)
+{
+	struct spawned *s = data;
+	char buf[32];
+	if (status > 0) fprintf(stderr, "meme: %s exited with status %d\n", s->line, status);
+	snprintf(buf, sizeof(buf), "status %d", status);
+	if (s->traced) trace('e', "spawn", "spawn", (unsigned long)s, 0, buf);
+	spawned_free(s);
+}
+static gboolean
+launcher_cb(GIOChannel *io, GIOCondition cond, gpointer data)
+{
+	return launcher_dispatch(launcher) == 0;
+}
+// the helper forks, so the browser never does. env's NAME=value entries
+// go to the command only
 void
-spawn (const char **cmd)
+spawn (const char **cmd, const char **env)
+{
+	unsigned long long t = now_ns();
+	struct spawned *s = g_new(struct spawned, 1);
+	s->line = g_strjoinv(" ", (gchar**)cmd);
+	s->traced = trace_enabled;
+	trace('b', "spawn", "spawn", (unsigned long)s, t, s->line);
+	if (launcher_spawn(launcher, cmd, env, spawn_done, s))
+	{
+		fprintf(stderr, "meme: could not run %s\n", s->line);
+		if (s->traced) trace('e', "spawn", "spawn", (unsigned long)s, 0, "failed");
+		spawned_free(s);
+	}
+	meter_add(&spawn_meter, now_ns() - t);
+}
+// a script file, converted once and re-read only when it changes on disk
+struct script {
+	const char *file;
+	JSStringRef source;
+	struct stat seen;
+};
+static struct script onload_script = { ONLOADFILE };
+static struct script run_script = { SCRIPTFILE };
+
+JSStringRef
+script_source (struct script *s)
 {
-	if(fork() == 0)
+	struct stat st;
+	if (!s->file) return NULL;
+	if (stat(s->file, &st))
+	{
+		fprintf(stderr, "failed to run: %s\n", s->file);
+		return NULL;
+	}
+	if (s->source && st.st_ino == s->seen.st_ino && st.st_size == s->seen.st_size
+		&& st.st_mtim.tv_sec == s->seen.st_mtim.tv_sec && st.st_mtim.tv_nsec == s->seen.st_mtim.tv_nsec)
+		return s->source;
+
+	GError *error = NULL; char *script;
+	if (!g_file_get_contents(s->file, &script, NULL, &error))
 	{
-		setsid();
-		execvp((char*)cmd[0], (char**)cmd);
-		fprintf(stderr, "meme: execvp %s", cmd[0]);
-		perror(" failed");
-		exit(0);
+		fprintf(stderr, "failed to run: %s\n", s->file);
+		g_error_free(error);
+		return NULL;
 	}
+	if (s->source) JSStringRelease(s->source);
+	s->source = JSStringCreateWithUTF8CString(script);
+	s->seen = st;
+	g_free(script);
+	return s->source;
 }
 void
-js_frame (char *script, WebKitWebFrame *frame)
+js_eval (JSStringRef jsscript, WebKitWebFrame *frame)
 {
 	JSValueRef exception = NULL;
-	JSStringRef jsscript = JSStringCreateWithUTF8CString(script);
 	JSContextRef ref = webkit_web_frame_get_global_context(frame);
 	JSEvaluateScript(ref, jsscript, JSContextGetGlobalObject(ref), NULL, 0, &exception);
 }
 void
-jsf_frame (char *src, WebKitWebFrame *frame)
+js_frame (char *script, WebKitWebFrame *frame)
+{
+	trace('B', "script", "eval", 0, 0, script);
+	JSStringRef jsscript = JSStringCreateWithUTF8CString(script);
+	js_eval(jsscript, frame);
+	JSStringRelease(jsscript);
+	trace('E', "script", "eval", 0, 0, NULL);
+}
+void
+jsf_frame (struct script *s, WebKitWebFrame *frame)
 {
-	if (!src) return;
-	GError *error = NULL; char *script;
-	if (g_file_get_contents(src, &script, NULL, &error)) js_frame(script, frame);
-	else fprintf(stderr, "failed to run: %s\n", src);
+	trace('B', "script", "eval", 0, 0, s->file);
+	JSStringRef source = script_source(s);
+	if (source) js_eval(source, frame);
+	trace('E', "script", "eval", 0, 0, NULL);
 }
 void
-js (char *script)
+js (struct browser *b, char *script)
 {
-	js_frame(script, webkit_web_view_get_main_frame(web_view));
+	js_frame(script, webkit_web_view_get_main_frame(b->view));
 }
 void
-jsf (char *src)
+jsf (struct browser *b, struct script *s)
 {
-	if (!src) return;
-	GError *error = NULL; char *script;
-	if (g_file_get_contents(src, &script, NULL, &error)) js(script);
-	else fprintf(stderr, "failed to run: %s\n", src);
+	jsf_frame(s, webkit_web_view_get_main_frame(b->view));
+}
+// run ONLOADFILE in the main frame, once per document
+void
+inject_onload (struct browser *b)
+{
+	if (b->onload_injected) return;
+	jsf(b, &onload_script);
+	b->onload_injected = TRUE;
 }
 void
-toggle_source_mode()
+toggle_source_mode(struct browser *b)
+{
+	gboolean s = webkit_web_view_get_view_source_mode(b->view);
+	webkit_web_view_set_view_source_mode(b->view, !s);
+	webkit_web_view_reload(b->view);
+}
+static void
+bookmark_changed(const char *uri, int added, void *data)
 {
-	gboolean s = webkit_web_view_get_view_source_mode(web_view);
-	webkit_web_view_set_view_source_mode(web_view, !s);
-	webkit_web_view_reload(web_view);
+	if (added) completion_add(uri_index, uri, 1.0);
+	else completion_remove(uri_index, uri);
+}
+static void
+bookmark_monitor_cb(GFileMonitor *monitor, GFile *file, GFile *other, GFileMonitorEvent event, gpointer data)
+{
+	if (event == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT
+		|| event == G_FILE_MONITOR_EVENT_CREATED || event == G_FILE_MONITOR_EVENT_DELETED)
+		bookmarks_sync(bookmarks, bookmark_changed, NULL);
 }
 void
 apply_bookmarks()
 {
 	if (!BOOKMARKFILE) return;
-	FILE *f = fopen(BOOKMARKFILE, "r");
-	if (!f)
+	if (!bookmarks)
 	{
-		fprintf(stderr, "could not read: %s\n", BOOKMARKFILE);
-		return;
-	}
+		// one index for the life of the process, patched as the file changes
+		bookmarks = bookmarks_new(BOOKMARKFILE);
 
-	uri_model = gtk_list_store_new(1, G_TYPE_STRING);
-	char line[BLOCK], *p;
-	while (fgets(line, BLOCK-2, f))
-	{
-		p = line; while (*p && *p != '\n') p++; *p = '\0';
-		if (strlen(line))
-		{
-			gtk_list_store_append(uri_model, &uri_iter);
-			gtk_list_store_set(uri_model, &uri_iter, 0, line, -1);
-		}
+		GFile *file = g_file_new_for_path(BOOKMARKFILE);
+		bookmark_monitor = g_file_monitor_file(file, G_FILE_MONITOR_NONE, NULL, NULL);
+		if (bookmark_monitor)
+			g_signal_connect(bookmark_monitor, "changed", G_CALLBACK(bookmark_monitor_cb), NULL);
+		g_object_unref(file);
 	}
-	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(uri_model), 0, GTK_SORT_ASCENDING);
-	gtk_entry_completion_set_model(uri_completion, GTK_TREE_MODEL(uri_model));
+	if (bookmarks_sync(bookmarks, bookmark_changed, NULL) < 0)
+		fprintf(stderr, "could not read: %s\n", BOOKMARKFILE);
+}
+static gboolean
+flush_bookmarks_cb(gpointer data)
+{
+	bookmark_flush_id = 0;
+	if (bookmarks_flush(bookmarks, FALSE))
+		fprintf(stderr, "could not write: %s\n", BOOKMARKFILE);
+	return FALSE;
+}
+void
+add_bookmark(const char *uri)
+{
+	if (!BOOKMARKFILE) return;
+	if (!bookmarks) apply_bookmarks();
 
-	fclose(f);
+	unsigned long long t = now_ns();
+	int rc = bookmarks_add(bookmarks, uri);
+	meter_add(&bookmark_add_meter, now_ns() - t);
+
+	if (rc < 0) fprintf(stderr, "could not write: %s\n", BOOKMARKFILE);
+	if (rc <= 0) return;
+	completion_add(uri_index, uri, 1.0);
+	if (!bookmark_flush_id)
+		bookmark_flush_id = g_timeout_add(BOOKMARKFLUSH, flush_bookmarks_cb, NULL);
 }
 static void
-select_uri_entry()
+history_changed(const char *uri, double score, void *data)
 {
-	gtk_editable_select_region(GTK_EDITABLE(uri_entry), 0, -1);
+	// set, not add, so a score can fall as old visits decay. a bookmark
+	// never ranks below its own 1.0
+	gboolean bookmark = bookmarks && bookmarks_has(bookmarks, uri);
+	completion_set_score(uri_index, uri, MAX(score, bookmark ? 1.0: 0));
+}
+static gpointer
+compact_history_thread(gpointer data)
+{
+	if (history_compact(HISTORYFILE, HISTORYHALFLIFE * 86400.0))
+		fprintf(stderr, "could not compact: %s\n", HISTORYFILE);
+	g_atomic_int_set(&history_compacting, FALSE);
+	return NULL;
+}
+void
+apply_history()
+{
+	if (!history || !history_loaded) return;
+	// only the log's tail, appended since the last sync
+	if (history_sync(history, history_changed, NULL))
+		fprintf(stderr, "could not read: %s\n", HISTORYFILE);
+	if (history_bloated(history) && !g_atomic_int_get(&history_compacting))
+	{
+		g_atomic_int_set(&history_compacting, TRUE);
+		g_thread_create(compact_history_thread, NULL, FALSE, NULL);
+	}
+}
+static gboolean
+history_loaded_cb(gpointer data)
+{
+	history_free(history);
+	history = data;
+	history_loaded = TRUE;
+	history_each(history, history_changed, NULL);
+	// visits made while it loaded
+	apply_history();
+	return FALSE;
+}
+// the whole log is read at startup on a thread of its own, into a history
+// nothing else touches until it is handed over here
+static gpointer
+load_history_thread(gpointer data)
+{
+	struct history *h = history_new(HISTORYFILE, HISTORYHALFLIFE * 86400.0);
+	if (history_sync(h, NULL, NULL))
+		fprintf(stderr, "could not read: %s\n", HISTORYFILE);
+	g_idle_add(history_loaded_cb, h);
+	return NULL;
+}
+void
+record_visit(const char *uri)
+{
+	if (!history || !uri || strstr(uri, "about:") == uri) return;
+	unsigned long long t = now_ns();
+	if (history_visit(history, uri, history_changed, NULL))
+		fprintf(stderr, "could not write: %s\n", HISTORYFILE);
+	meter_add(&history_visit_meter, now_ns() - t);
 }
 static void
-focus_uri_entry()
+select_uri_entry(struct browser *b)
 {
-	gtk_widget_grab_focus(GTK_WIDGET(uri_entry));
+	gtk_editable_select_region(GTK_EDITABLE(b->entry), 0, -1);
 }
 static void
-focus_web_view()
+focus_uri_entry(struct browser *b)
 {
-	gtk_widget_grab_focus (GTK_WIDGET (web_view));
+	gtk_widget_grab_focus(GTK_WIDGET(b->entry));
 }
 static void
-focus_in_uri_entry_cb()
+focus_web_view(struct browser *b)
+{
+	gtk_widget_grab_focus (GTK_WIDGET (b->view));
+}
+static gboolean
+focus_in_uri_entry_cb(GtkWidget *widget, GdkEventFocus *event, gpointer data)
 {
-	apply_bookmarks();
+	if (!bookmarks) apply_bookmarks();
+	apply_history();
+	return FALSE;
 }
 static void
-focus_uri_entry_search()
+focus_uri_entry_search(struct browser *b)
 {
-	focus_uri_entry();
-	gtk_entry_set_text(GTK_ENTRY(uri_entry), "/");
-	gtk_editable_set_position(GTK_EDITABLE(uri_entry), -1);
+	focus_uri_entry(b);
+	gtk_entry_set_text(GTK_ENTRY(b->entry), "/");
+	gtk_editable_set_position(GTK_EDITABLE(b->entry), -1);
 }
 static void
-focus_uri_entry_bookmark()
+focus_uri_entry_bookmark(struct browser *b)
 {
 	gint pos = 0;
-	focus_uri_entry();
-	gtk_editable_insert_text(GTK_EDITABLE(uri_entry), "!bookmark ", 10, &pos);
-	gtk_editable_select_region(GTK_EDITABLE(uri_entry), pos, -1);
+	focus_uri_entry(b);
+	gtk_editable_insert_text(GTK_EDITABLE(b->entry), "!bookmark ", 10, &pos);
+	gtk_editable_select_region(GTK_EDITABLE(b->entry), pos, -1);
+}
+void
+default_uri_entry(struct browser *b)
+{
+	gtk_entry_set_text(GTK_ENTRY(b->entry), webkit_web_view_get_uri(b->view));
+}
+// the WebKitWebSettings property behind each POLICY_x, and its value where
+// nothing decides it
+static const char *policy_props[POLICIES] = {
+	"auto-load-images", "enable-scripts", "enable-plugins", "enable-spell-checking", "enable-page-cache" };
+static gboolean policy_defaults[POLICIES] = { TRUE, TRUE, FALSE, TRUE, FALSE };
+
+// set the window up for a page on uri's host, before it loads
+static void
+apply_policy(struct browser *b, const char *uri)
+{
+	struct policy site = { 0, 0 };
+	int i, bit;
+	gboolean want, have;
+	SoupURI *u = policies && uri ? soup_uri_new(uri): NULL;
+	if (u && u->host)
+	{
+		unsigned long long t = now_ns();
+		policies_sync(policies);
+		policy_lookup(policies, u->host, &site);
+		meter_add(&policy_meter, now_ns() - t);
+	}
+	if (u) soup_uri_free(u);
+	for (i = 0; i < POLICIES; i++)
+	{
+		bit = 1 << i;
+		want = b->forced.set & bit ? !!(b->forced.on & bit):
+			site.set & bit ? !!(site.on & bit): policy_defaults[i];
+		// every change makes webkit copy all the settings to the page again
+		g_object_get(G_OBJECT(b->settings), policy_props[i], &have, NULL);
+		if (have != want) g_object_set(G_OBJECT(b->settings), policy_props[i], want, NULL);
+	}
+}
+void
+memory_describe(char *buf, size_t len)
+{
+	struct memory_status s;
+	memory_status(memory, &s);
+	int n = snprintf(buf, len, "%lluMB", s.rss >> 20);
+	if (s.budget) n += snprintf(buf+n, len-n, " of %lluMB", s.budget >> 20);
+	n += snprintf(buf+n, len-n, ", %d process%s %lluMB", s.processes, s.processes > 1 ? "es": "", s.rss_all >> 20);
+	if (s.budget_all) n += snprintf(buf+n, len-n, " of %lluMB", s.budget_all >> 20);
+	snprintf(buf+n, len-n, ", %s, %llu trims %llu restores %llu pressure events",
+		s.trimmed ? "trimmed": "normal", s.trims, s.restores, s.pressures);
+}
+// netem's connection limit, or the usual one
+static void
+apply_connections()
+{
+	g_object_set(G_OBJECT(webkit_get_default_session()), SOUP_SESSION_MAX_CONNS_PER_HOST,
+		netem.conns ? netem.conns: CONNSPERHOST, NULL);
+}
+// what one page load cost. its requests hold references, so a page can
+// outlive its window until the last of them finishes
+struct page {
+	int ref;
+	gchar *uri;
+	unsigned long long started, committed, loaded;  // ns
+	int requests, cached, failed, connections, active, peak;
+	unsigned long long bytes, dns, connect, ttfb, transfer;  // ns summed over requests
+	GHashTable *hosts;  // host -> struct host_load
+};
+struct host_load {
+	int active, peak, requests;
+};
+struct page*
+page_new(const char *uri)
+{
+	struct page *p = g_new0(struct page, 1);
+	p->ref = 1;
+	p->uri = g_strdup(uri);
+	p->started = now_ns();
+	p->hosts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	return p;
+}
+struct page*
+page_ref(struct page *p)
+{
+	p->ref++;
+	return p;
+}
+void
+page_unref(gpointer data)
+{
+	struct page *p = data;
+	if (--p->ref) return;
+	g_hash_table_destroy(p->hosts);
+	g_free(p->uri);
+	g_free(p);
+}
+// webkit's resource signals hand out copies of the session's messages, made
+// afresh each time, so nothing set on one side reaches the other. the two
+// meet by URI instead: a window leaves its page under each URI it asks for,
+// for request_queued_cb to take, and each message sent for a window leaves
+// its timing under the same URI for the window's resource events to find
+static GHashTable *pages_wanted;  // uri -> GQueue of struct page
+static GHashTable *requests_sent;  // uri -> GQueue of struct timing
+static void requests_drop(struct page *p);
+// the URI without its fragment, as soup sends it
+static gchar*
+request_key(SoupURI *uri)
+{
+	SoupURI *u = soup_uri_copy(uri);
+	soup_uri_set_fragment(u, NULL);
+	gchar *key = soup_uri_to_string(u, FALSE);
+	soup_uri_free(u);
+	return key;
+}
+static gchar*
+request_key_str(const char *uri)
+{
+	SoupURI *u = soup_uri_new(uri);
+	if (!u) return g_strdup(uri);
+	gchar *key = request_key(u);
+	soup_uri_free(u);
+	return key;
+}
+static void
+link_push(GHashTable **table, const char *key, gpointer item)
+{
+	if (!*table) *table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_queue_free);
+	GQueue *q = g_hash_table_lookup(*table, key);
+	if (!q)
+	{
+		q = g_queue_new();
+		g_hash_table_insert(*table, g_strdup(key), q);
+	}
+	g_queue_push_tail(q, item);
+}
+// take the oldest item left under key, or NULL
+static gpointer
+link_pop(GHashTable *table, const char *key)
+{
+	GQueue *q = table ? g_hash_table_lookup(table, key): NULL;
+	if (!q) return NULL;
+	gpointer item = g_queue_pop_head(q);
+	if (g_queue_is_empty(q)) g_hash_table_remove(table, key);
+	return item;
+}
+// take item from under key, if it is still there
+static gboolean
+link_remove(GHashTable *table, const char *key, gpointer item)
+{
+	GQueue *q = table ? g_hash_table_lookup(table, key): NULL;
+	if (!q || !g_queue_remove(q, item)) return FALSE;
+	if (g_queue_is_empty(q)) g_hash_table_remove(table, key);
+	return TRUE;
+}
+static gboolean
+wanted_drop_cb(gpointer key, gpointer value, gpointer data)
+{
+	GQueue *q = value;
+	while (g_queue_remove(q, data)) page_unref(data);
+	return g_queue_is_empty(q);
+}
+// the window moves on: fold its page into the meters
+void
+page_end(struct browser *b)
+{
+	struct page *p = b->page;
+	GHashTableIter iter;
+	gpointer h;
+	if (!p) return;
+	b->page = NULL;
+	// asked for but never sent, as with soup following a redirect itself
+	if (pages_wanted) g_hash_table_foreach_remove(pages_wanted, wanted_drop_cb, p);
+	requests_drop(p);
+	if (p->committed)
+	{
+		meter_add(&page_requests_meter, p->requests);
+		meter_add(&page_bytes_meter, p->bytes);
+		g_hash_table_iter_init(&iter, p->hosts);
+		while (g_hash_table_iter_next(&iter, NULL, &h))
+			meter_add(&page_hosts_meter, ((struct host_load*)h)->peak);
+	}
+	page_unref(p);
+}
+static void
+stats_value(char *buf, size_t len, const char *unit, unsigned long long v)
+{
+	if (!strcmp(unit, "ns")) snprintf(buf, len, "%.1fms", v / 1e6);
+	else if (!strcmp(unit, "bytes")) snprintf(buf, len, "%.1fKB", v / 1024.0);
+	else snprintf(buf, len, "%llu", v);
+}
+// for monitoring: the same meters, machine-readable
+void
+stats_json(FILE *f)
+{
+	fprintf(f, "{ \"pid\": %d, \"time\": %lld, \"meters\": ", (int)getpid(), (long long)time(NULL));
+	meter_json(f);
+	fputs("}\n", f);
+}
+void
+stats_html(FILE *f, struct page *p)
+{
+	struct meter *m;
+	char a[32], c[32], d[32], e[32], g[32];
+	int i, lo, hi, height;
+	unsigned long long most;
+
+	fputs("<html><head><title>meme stats</title><style>"
+		"body { font: 13px sans-serif } td, th { padding: 0 0.8em; text-align: right }"
+		" td:first-child, th:first-child { text-align: left }"
+		" .bar { display: inline-block; width: 4px; margin-right: 1px; background: #68c }"
+		"</style></head><body>", f);
+	if (p)
+	{
+		gchar *uri = g_markup_escape_text(p->uri, -1);
+		fprintf(f, "<h3>%s</h3><table>", uri);
+		g_free(uri);
+		stats_value(a, sizeof(a), "ns", p->committed ? p->committed - p->started: 0);
+		stats_value(c, sizeof(c), "ns", p->loaded ? p->loaded - p->committed: 0);
+		stats_value(d, sizeof(d), "bytes", p->bytes);
+		fprintf(f, "<tr><td>request to commit<td>%s<tr><td>commit to onload<td>%s", a, p->committed ? c: "-");
+		fprintf(f, "<tr><td>requests<td>%d<tr><td>from cache<td>%d<tr><td>failed<td>%d", p->requests, p->cached, p->failed);
+		fprintf(f, "<tr><td>new connections<td>%d<tr><td>most at once<td>%d<tr><td>bytes<td>%s", p->connections, p->peak, d);
+		stats_value(a, sizeof(a), "ns", p->dns);
+		stats_value(c, sizeof(c), "ns", p->connect);
+		stats_value(d, sizeof(d), "ns", p->ttfb);
+		stats_value(e, sizeof(e), "ns", p->transfer);
+		fprintf(f, "<tr><td>dns, summed<td>%s<tr><td>connect<td>%s<tr><td>first byte<td>%s<tr><td>transfer<td>%s</table>",
+			a, c, d, e);
+
+		GHashTableIter iter;
+		gpointer host, h;
+		fputs("<table><tr><th>host<th>requests<th>most at once", f);
+		g_hash_table_iter_init(&iter, p->hosts);
+		while (g_hash_table_iter_next(&iter, &host, &h))
+			fprintf(f, "<tr><td>%s<td>%d<td>%d", (char*)host,
+				((struct host_load*)h)->requests, ((struct host_load*)h)->peak);
+		fputs("</table>", f);
+	}
+
+	fputs("<h3>this process</h3><table><tr><th>meter<th>count<th>mean<th>p50<th>p90<th>p99<th>max<th>", f);
+	for (m = meter_next(NULL); m; m = meter_next(m))
+	{
+		stats_value(a, sizeof(a), m->unit, m->count ? m->total / m->count: 0);
+		stats_value(c, sizeof(c), m->unit, meter_quantile(m, 0.5));
+		stats_value(d, sizeof(d), m->unit, meter_quantile(m, 0.9));
+		stats_value(e, sizeof(e), m->unit, meter_quantile(m, 0.99));
+		stats_value(g, sizeof(g), m->unit, m->max);
+		fprintf(f, "<tr><td>%s<td>%llu<td>%s<td>%s<td>%s<td>%s<td>%s<td>", m->name, m->count, a, c, d, e, g);
+		// the log2 histogram, one bar per power of two
+		for (lo = 0; lo < METER_BUCKETS && !m->buckets[lo]; lo++);
+		for (hi = METER_BUCKETS; hi > lo && !m->buckets[hi-1]; hi--);
+		for (most = 0, i = lo; i < hi; i++) if (m->buckets[i] > most) most = m->buckets[i];
+		for (i = lo; i < hi; i++)
+		{
+			height = m->buckets[i] ? 1 + 15 * m->buckets[i] / most: 0;
+			stats_value(a, sizeof(a), m->unit, i ? 1ULL << (i-1): 0);
+			fprintf(f, "<span class=bar style=\"height: %dpx\" title=\"%s+: %llu\"></span>", height, a, m->buckets[i]);
+		}
+	}
+	fputs("</table></body></html>", f);
 }
+// "!stats" as a page, or "!stats json"
 void
-default_uri_entry()
+show_stats(struct browser *b, gboolean json)
 {
-	gtk_entry_set_text(GTK_ENTRY(uri_entry), webkit_web_view_get_uri(web_view));
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *f = open_memstream(&buf, &len);
+	if (!f) return;
+	if (json) stats_json(f);
+	else stats_html(f, b->page);
+	fclose(f);
+	webkit_web_view_load_string(b->view, buf, json ? "text/plain": "text/html", "UTF-8", "about:stats");
+	free(buf);
+}
+// write STATSDIR/pid.json whole, for anything watching
+static gboolean
+stats_save_cb(gpointer data)
+{
+	char file[BLOCK], tmp[BLOCK];
+	snprintf(file, sizeof(file), "%s%d.json", STATSDIR, (int)getpid());
+	snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+	FILE *f = fopen(tmp, "w");
+	if (!f) return TRUE;
+	stats_json(f);
+	if (fclose(f) || rename(tmp, file)) unlink(tmp);
+	return TRUE;
 }
 static void
 activate_uri_entry_cb (GtkWidget* entry, gpointer data)
 {
+	struct browser *b = data;
 	char pad[BLOCK], tmp[BLOCK];
 	const gchar* uri = gtk_entry_get_text (GTK_ENTRY (entry));
 	if (!uri) return;
+	int kind = entry_classify(uri, SEARCHURL, pad, sizeof(pad));
 	// find text
-	if (strstr(uri, "/") == uri)
+	if (kind == ENTRY_FIND)
 	{
-		webkit_web_view_search_text(web_view, uri+1, FALSE, TRUE, TRUE);
+		webkit_web_view_search_text(b->view, uri+1, FALSE, TRUE, TRUE);
 		return;
 	}
 	// command
-	if (strstr(uri, "!") == uri)
+	if (kind == ENTRY_COMMAND)
 	{
-		gboolean flag;
-		if (strstr(uri+1, "plugins") == uri+1)
+		int len = strcspn(uri+1, " "), setting;
+		snprintf(tmp, sizeof(tmp), "%.*s", len, uri+1);
+		// "!images off", "!plugins on"... for this window; bare, back to the site's
+		if ((setting = policy_setting(tmp)) >= 0)
+		{
+			const char *arg = uri[len+1] ? uri+len+2: "";
+			int bit = 1 << setting;
+			b->forced.set &= ~bit;
+			b->forced.on &= ~bit;
+			if (!strcmp(arg, "on")) b->forced.on |= bit;
+			if (!strcmp(arg, "on") || !strcmp(arg, "off")) b->forced.set |= bit;
+			apply_policy(b, webkit_web_view_get_uri(b->view));
+			default_uri_entry(b);
+			if (setting != POLICY_SPELL) webkit_web_view_reload(b->view);
+		} else
+		if (strstr(uri+1, "block") == uri+1 && (!uri[6] || uri[6] == ' '))
+		{
+			b->block = uri[6] ? strstr(uri+7, "on") == uri+7: !b->block;
+			default_uri_entry(b);
+			webkit_web_view_reload(b->view);
+		} else
+		if (strstr(uri+1, "trace") == uri+1 && (!uri[6] || uri[6] == ' '))
+		{
+			// "!trace" toggles, "!trace FILE" starts writing to FILE
+			if (trace_enabled)
+			{
+				trace_stop();
+				snprintf(pad, sizeof(pad), "!trace: wrote %s", trace_file);
+			}
+			else
+			{
+				if (uri[6]) snprintf(trace_file, sizeof(trace_file), "%s", uri+7);
+				else snprintf(trace_file, sizeof(trace_file), TRACEFILE, (int)getpid());
+				snprintf(pad, sizeof(pad), trace_start(trace_file) ? "!trace: could not write %s":
+					"!trace: writing %s", trace_file);
+			}
+			gtk_entry_set_text(GTK_ENTRY(b->entry), pad);
+		} else
+		if (!strcmp(uri+1, "stats") || !strcmp(uri+1, "stats json"))
+		{
+			show_stats(b, uri[6] != '\0');
+		} else
+		if (strstr(uri+1, "netem") == uri+1 && (!uri[6] || uri[6] == ' '))
+		{
+			// "!netem" shows, "!netem off", "!netem 3g", "!netem DELAY RATE LOSS CONNS" change
+			if (uri[6] && netem_parse(&netem, uri+7)) snprintf(tmp, sizeof(tmp), "not understood");
+			else netem_describe(&netem, tmp, sizeof(tmp));
+			apply_connections();
+			snprintf(pad, sizeof(pad), "!netem: %s", tmp);
+			gtk_entry_set_text(GTK_ENTRY(b->entry), pad);
+		} else
+		if (!strcmp(uri+1, "memory") && memory)
 		{
-			flag = strstr(uri+9, "on") == uri+9 ? TRUE: FALSE;
-			g_object_set(G_OBJECT(web_settings), "enable-plugins", flag, NULL);
-			default_uri_entry();
-			webkit_web_view_reload(web_view);
+			memory_describe(tmp, sizeof(tmp));
+			snprintf(pad, sizeof(pad), "!memory: %s", tmp);
+			gtk_entry_set_text(GTK_ENTRY(b->entry), pad);
 		} else
 		if (strstr(uri+1, "bookmark") == uri+1 && isalnum(uri[10]))
 		{
-			sprintf(pad, "echo %s >> %s && sort -u -o %s %s",
-				uri+10, BOOKMARKFILE, BOOKMARKFILE, BOOKMARKFILE);
-			if (!system(pad)) apply_bookmarks();
-			default_uri_entry();
+			add_bookmark(uri+10);
+			default_uri_entry(b);
 		}
 		return;
 	}
-	if (strcmp(uri, "about:bookmarks") == 0)
+	if (kind == ENTRY_BOOKMARKS)
 	{
-		sprintf(pad, "file://%s", BOOKMARKFILE);
-		webkit_web_view_load_uri(web_view, pad);
+		snprintf(pad, sizeof(pad), "file://%s", BOOKMARKFILE);
+		webkit_web_view_load_uri(b->view, pad);
 		return;
 	}
-	// convert a non-fqdn to a search term
-	if (!strstr(uri, "localhost") && (strstr(uri, " ") || !strstr(uri, ".")))
-	{
-		int j = 0, i = 0;
-		while (uri[j])
-		{
-			if (isalnum(uri[j])) tmp[i++] = uri[j];
-			else i += sprintf(tmp+i, "%%%x", uri[j]);
-			j++;
-		} tmp[i] = '\0';
-		sprintf(pad, SEARCHURL, tmp);
-	} else
-	{
-		sprintf(pad, "%s%s", strstr(uri, "://") ? "": "http://", uri);
-	}
-	webkit_web_view_load_uri (web_view, pad);
+	// a search term or URI too long for pad is left in the entry
+	if (kind >= 0) webkit_web_view_load_uri (b->view, pad);
 }
 static void
-update_title (GtkWindow* window)
+update_title (struct browser *b)
 {
-	GString* string = g_string_new(main_title && strlen(main_title) ? main_title : "untitled");
-	if (load_progress < 100)
+	// a load starts before the window exists
+	if (!b->window) return;
+	GString* string = g_string_new(b->title && strlen(b->title) ? b->title : "untitled");
+	if (b->progress < 100)
 	{
-		int d = load_progress;
+		int d = b->progress;
 		g_string_append_printf (string, " (%d%%)", d);
 	}
+	if (b->blocked) g_string_append_printf (string, " [%d blocked]", b->blocked);
+	int running, queued;
+	double rate, fraction;
+	if (downloads) downloads_status(downloads, &running, &queued, &rate, &fraction);
+	if (downloads && (running || queued))
+	{
+		g_string_append_printf (string, " [%d download%s", running + queued, running + queued > 1 ? "s": "");
+		if (fraction >= 0) g_string_append_printf (string, " %d%%", (int)(fraction * 100));
+		g_string_append_printf (string, " %.1fMB/s]", rate / 1e6);
+	}
 	g_string_append(string, " - Meme");
 	gchar* title = g_string_free (string, FALSE);
-	gtk_window_set_title (window, title);
+	gtk_window_set_title (GTK_WINDOW (b->window), title);
 	g_free (title);
 }
-static void
-link_hover_cb (WebKitWebView* page, const gchar* title, const gchar* link, gpointer data)
+// downloads run in this process, so it outlives its last window until
+// they are done
+static gboolean
+downloads_pending()
 {
-	if (link) gtk_entry_set_text (GTK_ENTRY (uri_entry), link);
-	else default_uri_entry();
+	int running, queued;
+	double rate, fraction;
+	if (!downloads) return FALSE;
+	downloads_status(downloads, &running, &queued, &rate, &fraction);
+	return running + queued > 0;
 }
 static void
-notify_title_cb (WebKitWebView* web_view, GParamSpec* pspec, gpointer data)
+download_event_cb(const char *file, int event, void *data)
 {
-	if (main_title) g_free (main_title);
-	main_title = g_strdup(webkit_web_view_get_title(web_view));
-	update_title (GTK_WINDOW (main_window));
+	GList *l;
+	if (event == DOWNLOAD_DONE) fprintf(stderr, "downloaded: %s\n", file);
+	if (event == DOWNLOAD_FAILED) fprintf(stderr, "download failed: %s\n", file);
+	for (l = browsers; l; l = l->next) update_title(l->data);
+	if (!browsers && event != DOWNLOAD_PROGRESS && !downloads_pending()) gtk_main_quit();
 }
+// speculative connections: a link hovered, or a completion ranked first,
+// for PRECONNECTDWELL ms gets a HEAD sent to its origin, which leaves the
+// connection, TLS and all, open in the session's pool. one per host, at most
+// PRECONNECTMAX live at once. one is used if a request goes to its host
+// within PRECONNECTIDLE seconds
+static GHashTable *preconnects;  // host -> when, ns
+static gchar *preconnect_uri;
+static guint preconnect_id;
+static struct meter preconnect_used_meter = METER("preconnect used", "ns");
+static struct meter preconnect_wasted_meter = METER("preconnect wasted", "hosts");
+
 static void
-notify_load_status_cb (WebKitWebView* web_view, GParamSpec* pspec, gpointer data)
+preconnect_expire(unsigned long long now)
 {
-	if (webkit_web_view_get_load_status (web_view) == WEBKIT_LOAD_COMMITTED)
-		notify_title_cb(web_view, pspec, data);
+	GHashTableIter iter;
+	gpointer host, when;
+	g_hash_table_iter_init(&iter, preconnects);
+	while (g_hash_table_iter_next(&iter, &host, &when))
+	{
+		if (now - *(unsigned long long*)when < PRECONNECTIDLE * 1000000000ULL) continue;
+		meter_add(&preconnect_wasted_meter, 1);
+		g_hash_table_iter_remove(&iter);
+	}
 }
-static void
-notify_progress_cb (WebKitWebView* web_view, GParamSpec* pspec, gpointer data)
+static gboolean
+preconnect_cb(gpointer data)
+{
+	preconnect_id = 0;
+	SoupURI *uri = soup_uri_new(preconnect_uri);
+	unsigned long long now = now_ns();
+	preconnect_expire(now);
+	if (uri && uri->host && (uri->scheme == SOUP_URI_SCHEME_HTTP || uri->scheme == SOUP_URI_SCHEME_HTTPS)
+		&& !g_hash_table_lookup(preconnects, uri->host) && g_hash_table_size(preconnects) < PRECONNECTMAX)
+	{
+		unsigned long long *when = g_new(unsigned long long, 1);
+		*when = now;
+		g_hash_table_insert(preconnects, g_strdup(uri->host), when);
+		// prepare_for_uri would only resolve the name. the origin, not the
+		// link: nothing but a GET was ever asked of the link
+		SoupURI *origin = soup_uri_copy_host(uri);
+		SoupMessage *msg = soup_message_new_from_uri("HEAD", origin);
+		g_object_set_data(G_OBJECT(msg), "meme-preconnect", GINT_TO_POINTER(1));
+		soup_session_queue_message(webkit_get_default_session(), msg, NULL, NULL);
+		soup_uri_free(origin);
+	}
+	if (uri) soup_uri_free(uri);
+	return FALSE;
+}
+// (re)start the dwell timer, so only where the pointer settles connects.
+// NULL just cancels
+void
+preconnect(const char *uri)
 {
-	load_progress = webkit_web_view_get_progress (web_view) * 100;
-	update_title (GTK_WINDOW (main_window));
+	if (!preconnects) return;
+	if (preconnect_id) g_source_remove(preconnect_id);
+	preconnect_id = 0;
+	g_free(preconnect_uri);
+	preconnect_uri = uri ? g_strdup(uri): NULL;
+	if (uri) preconnect_id = g_timeout_add(PRECONNECTDWELL, preconnect_cb, NULL);
 }
 static void
-destroy_cb (GtkWidget* widget, gpointer data)
+preconnect_used(const char *host)
 {
-	gtk_main_quit ();
+	unsigned long long *when;
+	if (!preconnects || !host || !(when = g_hash_table_lookup(preconnects, host))) return;
+	unsigned long long lead = now_ns() - *when;
+	if (lead < PRECONNECTIDLE * 1000000000ULL) meter_add(&preconnect_used_meter, lead);
+	else meter_add(&preconnect_wasted_meter, 1);
+	g_hash_table_remove(preconnects, host);
 }
+// prefetch: past PREFETCHDWELL ms, the document itself is fetched at low
+// priority through the session, so SoupCache keeps it for the click. one
+// at a time and at most PREFETCHBYTES, HTML only, dropped as soon as
+// another target comes along. one is used if visited within PREFETCHIDLE
+struct prefetch {
+	gchar *uri;
+	GCancellable *cancel;
+	SoupRequest *req;
+	GInputStream *in;
+	gsize bytes;
+	char buf[16384];
+};
+static struct prefetch *prefetching;
+static gchar *prefetch_uri;
+static guint prefetch_id;
+static GHashTable *prefetched;  // uri -> struct prefetched
+struct prefetched {
+	unsigned long long when;
+	gsize bytes;
+};
+static struct meter prefetch_used_meter = METER("prefetch used", "bytes");
+static struct meter prefetch_wasted_meter = METER("prefetch wasted", "bytes");
+
 static void
-go_home_cb (GtkWidget* widget, gpointer data)
+prefetch_expire(unsigned long long now)
 {
-	webkit_web_view_load_uri (web_view, HOMEPAGE);
+	GHashTableIter iter;
+	gpointer uri, value;
+	g_hash_table_iter_init(&iter, prefetched);
+	while (g_hash_table_iter_next(&iter, &uri, &value))
+	{
+		struct prefetched *p = value;
+		if (now - p->when < PREFETCHIDLE * 1000000000ULL) continue;
+		meter_add(&prefetch_wasted_meter, p->bytes);
+		g_hash_table_iter_remove(&iter);
+	}
 }
 static void
-go_back_cb (GtkWidget* widget, gpointer data)
+prefetch_free(struct prefetch *p)
 {
-	if (webkit_web_view_can_go_back(web_view))
-		webkit_web_view_go_back_or_forward(web_view, -1);
-	else exit(0);
+	if (prefetching == p) prefetching = NULL;
+	if (p->in) g_object_unref(p->in);
+	g_object_unref(p->req);
+	g_object_unref(p->cancel);
+	g_free(p->uri);
+	g_free(p);
 }
 static void
-go_forward_cb (GtkWidget* widget, gpointer data)
+prefetch_read_cb(GObject *source, GAsyncResult *res, gpointer data)
 {
-	webkit_web_view_go_back_or_forward(web_view, 1);
+	struct prefetch *p = data;
+	gssize n = g_input_stream_read_finish(p->in, res, NULL);
+	if (n > 0 && p->bytes + n <= PREFETCHBYTES)
+	{
+		p->bytes += n;
+		g_input_stream_read_async(p->in, p->buf, sizeof(p->buf), G_PRIORITY_LOW, p->cancel, prefetch_read_cb, p);
+		return;
+	}
+	if (n == 0)
+	{
+		// closing the stream is what commits the cache entry
+		g_input_stream_close(p->in, NULL, NULL);
+		struct prefetched *done = g_new(struct prefetched, 1);
+		done->when = now_ns();
+		done->bytes = p->bytes;
+		g_hash_table_replace(prefetched, g_strdup(p->uri), done);
+	}
+	else if (n > 0) g_cancellable_cancel(p->cancel);
+	prefetch_free(p);
 }
 static void
-go_reload_cb (GtkWidget* widget, gpointer data)
+prefetch_sent_cb(GObject *source, GAsyncResult *res, gpointer data)
 {
-	webkit_web_view_reload_bypass_cache(web_view);
+	struct prefetch *p = data;
+	p->in = soup_request_send_finish(p->req, res, NULL);
+	SoupMessage *msg = soup_request_http_get_message(SOUP_REQUEST_HTTP(p->req));
+	const char *type = soup_request_get_content_type(p->req);
+	gboolean html = type && (g_str_has_prefix(type, "text/html") || g_str_has_prefix(type, "application/xhtml+xml"));
+
+	if (p->in && msg->status_code == SOUP_STATUS_OK && html && soup_request_get_content_length(p->req) <= PREFETCHBYTES)
+		g_input_stream_read_async(p->in, p->buf, sizeof(p->buf), G_PRIORITY_LOW, p->cancel, prefetch_read_cb, p);
+	else
+	{
+		if (p->in) g_cancellable_cancel(p->cancel);
+		prefetch_free(p);
+	}
+	g_object_unref(msg);
 }
-gboolean
-download_request_cb(WebKitWebView *view, WebKitDownload *o, gpointer v)
+static gboolean
+prefetch_cb(gpointer data)
 {
-	char *buf = getcwd(NULL, 0);
-	const char *uri = webkit_download_get_uri(o);
-	spawn(DOWNLOAD(uri,
-		webkit_download_get_suggested_filename(o),
-		webkit_web_view_get_uri(web_view),
-		buf));
-	free(buf);
+	prefetch_id = 0;
+	prefetch_expire(now_ns());
+	if (g_hash_table_lookup(prefetched, prefetch_uri)) return FALSE;
+	if (strncmp(prefetch_uri, "http://", 7) && strncmp(prefetch_uri, "https://", 8)) return FALSE;
+	// a query is too often an action: search, unsubscribe, confirm
+	if (strchr(prefetch_uri, '?')) return FALSE;
+
+	SoupRequestHTTP *req = soup_session_request_http(webkit_get_default_session(), "GET", prefetch_uri, NULL);
+	if (!req) return FALSE;
+	SoupMessage *msg = soup_request_http_get_message(req);
+	soup_message_headers_replace(msg->request_headers, "User-Agent", USERAGENT);
+	// lets servers and their logs tell speculation from visits
+	soup_message_headers_replace(msg->request_headers, "Purpose", "prefetch");
+	g_object_unref(msg);
+
+	struct prefetch *p = g_new0(struct prefetch, 1);
+	p->uri = g_strdup(prefetch_uri);
+	p->req = SOUP_REQUEST(req);
+	p->cancel = g_cancellable_new();
+	prefetching = p;
+	soup_request_send_async(p->req, p->cancel, prefetch_sent_cb, p);
 	return FALSE;
 }
-gboolean
-mime_type_policy_decision_requested_cb(WebKitWebView* view, WebKitWebFrame* frame, WebKitNetworkRequest* request, const char* mime_type, WebKitWebPolicyDecision* decision, gpointer data)
+// restart the dwell timer. anything in flight for another target is
+// dropped; NULL just cancels
+void
+prefetch(const char *uri)
 {
-	if (!webkit_web_view_can_show_mime_type(view, mime_type))
+	if (!prefetched) return;
+	if (prefetching && (!uri || strcmp(uri, prefetching->uri)))
 	{
-		webkit_web_policy_decision_download(decision);
-		return TRUE;
+		g_cancellable_cancel(prefetching->cancel);
+		prefetching = NULL;
 	}
-	return FALSE;
+	if (prefetch_id) g_source_remove(prefetch_id);
+	prefetch_id = 0;
+	g_free(prefetch_uri);
+	prefetch_uri = uri ? g_strdup(uri): NULL;
+	if (uri && !prefetching) prefetch_id = g_timeout_add(PREFETCHDWELL, prefetch_cb, NULL);
 }
-gboolean
-new_window_policy_decision_requested_cb(WebKitWebView *view, WebKitWebFrame *frame, WebKitNetworkRequest *req, WebKitWebNavigationAction *nav, WebKitWebPolicyDecision *decision, gpointer data)
+static void
+prefetch_visited(const char *uri)
 {
-	if (webkit_web_navigation_action_get_reason(nav) == WEBKIT_WEB_NAVIGATION_REASON_LINK_CLICKED)
-	{
-		webkit_web_policy_decision_ignore(decision);
-		spawn(NEWWINDOW(webkit_network_request_get_uri(req)));
-		return TRUE;
-	}
-	return FALSE;
+	struct prefetched *p;
+	if (!prefetched || !uri || !(p = g_hash_table_lookup(prefetched, uri))) return;
+	if (now_ns() - p->when < PREFETCHIDLE * 1000000000ULL) meter_add(&prefetch_used_meter, p->bytes);
+	else meter_add(&prefetch_wasted_meter, p->bytes);
+	g_hash_table_remove(prefetched, uri);
 }
-void
-open_new_window(const char *uri)
+static void
+link_hover_cb (WebKitWebView* page, const gchar* title, const gchar* link, gpointer data)
 {
-	spawn(NEWWINDOW(uri));
+	struct browser *b = data;
+	if (link) gtk_entry_set_text (GTK_ENTRY (b->entry), link);
+	else default_uri_entry(b);
+
+	// links within this site already have a connection to use, and are the
+	// ones most likely to log out or change state, so aren't prefetched
+	SoupURI *here = soup_uri_new(webkit_web_view_get_uri(page));
+	SoupURI *there = link ? soup_uri_new(link): NULL;
+	gboolean away = there && there->host && !(here && here->host && !strcmp(here->host, there->host));
+	if (here) soup_uri_free(here);
+	if (there) soup_uri_free(there);
+	preconnect(away ? link: NULL);
+	prefetch(away ? link: NULL);
 }
-WebKitWebView*
-create_web_view_cb(WebKitWebView *web_view, WebKitWebFrame *frame, gpointer user_data)
+static void
+notify_title_cb (WebKitWebView* web_view, GParamSpec* pspec, gpointer data)
 {
-	open_new_window(gtk_entry_get_text(GTK_ENTRY(uri_entry)));
-	return NULL;
+	struct browser *b = data;
+	if (b->title) g_free (b->title);
+	b->title = g_strdup(webkit_web_view_get_title(web_view));
+	update_title (b);
 }
-void
-key_action(const char *action)
-{
-	if (!strcmp(action, "go-home")) go_home_cb(NULL, NULL);
-	else if (!strcmp(action, "go-back")) go_back_cb(NULL, NULL);
-	else if (!strcmp(action, "go-forward")) go_forward_cb(NULL, NULL);
-	else if (!strcmp(action, "zoom-in")) webkit_web_view_zoom_in(web_view);
-	else if (!strcmp(action, "zoom-out")) webkit_web_view_zoom_out(web_view);
-	else if (!strcmp(action, "zoom-reset")) webkit_web_view_set_zoom_level(web_view, 1.0);
-	else if (!strcmp(action, "toggle-source")) toggle_source_mode();
-	else if (!strcmp(action, "reload-nocache")) webkit_web_view_reload_bypass_cache(web_view);
-	else if (!strcmp(action, "run-scriptfile")) jsf(SCRIPTFILE);
-	else if (!strcmp(action, "focus-navbar")) { focus_uri_entry(); select_uri_entry(); }
-	else if (!strcmp(action, "new-window")) open_new_window(HOMEPAGE);
-	else if (!strcmp(action, "print-page")) webkit_web_frame_print(webkit_web_view_get_main_frame(web_view));
-	else if (!strcmp(action, "find-text")) focus_uri_entry_search();
-	else if (!strcmp(action, "bookmark-page")) focus_uri_entry_bookmark();
-	else fprintf(stderr, "unknown action: %s\n", action);
+void hints_clear(struct browser *b);
+void bench_status(struct browser *b, WebKitLoadStatus status);
+void bench_onload(struct browser *b);
+// -T: when each phase of startup ended, reported at the first paint.
+// startup_base is when the window was asked for
+#define STARTUP_MARKS 16
+static struct {
+	const char *name;
+	unsigned long long at;
+} startup[STARTUP_MARKS];
+static int startup_marks;
+static unsigned long long startup_base;
+static gboolean startup_reported;
+
+static void
+startup_mark(const char *name)
+{
+	if (startup_reported || startup_marks == STARTUP_MARKS) return;
+	startup[startup_marks].name = name;
+	startup[startup_marks++].at = now_ns();
+	trace('i', "startup", name, 0, 0, NULL);
 }
-gboolean
-keypress_cb(GtkWidget* widget, GdkEventKey *ev, gpointer data)
+static void
+startup_report(const char *uri)
 {
-	guint m = (ev->state & ~(GDK_MOD2_MASK));
-	guint k = gdk_keyval_to_lower(ev->keyval);
-	if (!m && k == GDK_Escape)
+	int i;
+	unsigned long long last = startup_base;
+	startup_mark("first paint");
+	startup_reported = TRUE;
+	if (!flag_timing) return;
+	fprintf(stderr, "startup:");
+	for (i = 0; i < startup_marks; i++)
 	{
-		default_uri_entry();
-		focus_web_view();
+		fprintf(stderr, "%s %s %.1fms", i ? ",": "", startup[i].name, (startup[i].at - last) / 1e6);
+		last = startup[i].at;
 	}
-	int i = 0; while (keys[i].action)
+	fprintf(stderr, " = %.1fms %s\n", (last - startup_base) / 1e6, uri);
+}
+static void
+notify_load_status_cb (WebKitWebView* web_view, GParamSpec* pspec, gpointer data)
+{
+	struct browser *b = data;
+	static const char *states[] = { "provisional", "committed", "finished", "first layout", "failed" };
+	WebKitLoadStatus status = webkit_web_view_get_load_status(web_view);
+	if (status < G_N_ELEMENTS(states))
+		trace('i', "load", states[status], 0, 0, webkit_web_view_get_uri(web_view));
+	if (bench) bench_status(b, status);
+	// settings follow a navigation as it is decided. one that stops without
+	// committing gives them back to the page still shown; cancelling it for
+	// a newer one does the same, so the newer one takes them again as it starts
+	if (status == WEBKIT_LOAD_PROVISIONAL)
 	{
-		if (keys[i].mod == m && keys[i].key == k)
-		{
-			key_action(keys[i].action);
-			break;
-		}
-		i++;
+		WebKitWebDataSource *ds = webkit_web_frame_get_provisional_data_source(webkit_web_view_get_main_frame(web_view));
+		if (ds) apply_policy(b, webkit_network_request_get_uri(webkit_web_data_source_get_request(ds)));
 	}
-	i = 0; while (jskeys[i].action)
+	else
+	if (status == WEBKIT_LOAD_FAILED || (status == WEBKIT_LOAD_FINISHED && b->provisional))
+		apply_policy(b, webkit_web_view_get_uri(web_view));
+	if (status != WEBKIT_LOAD_FIRST_VISUALLY_NON_EMPTY_LAYOUT) b->provisional = status == WEBKIT_LOAD_PROVISIONAL;
+	if (status == WEBKIT_LOAD_COMMITTED)
 	{
-		if (jskeys[i].mod == m && jskeys[i].key == k)
-		{
-			js(jskeys[i].action);
-			break;
-		}
-		i++;
+		b->onload_injected = FALSE;
+		b->committed = TRUE;
+		startup_mark("committed");
+		if (b->page && !b->page->committed) b->page->committed = now_ns();
+		b->blocked = 0;
+		g_free(b->host);
+		SoupURI *here = soup_uri_new(webkit_web_view_get_uri(web_view));
+		b->host = here && here->host ? g_strdup(here->host): NULL;
+		if (here) soup_uri_free(here);
+		hints_clear(b);
+		notify_title_cb(web_view, pspec, data);
+		record_visit(webkit_web_view_get_uri(web_view));
+		prefetch_visited(webkit_web_view_get_uri(web_view));
+	}
+}
+static void
+notify_progress_cb (WebKitWebView* web_view, GParamSpec* pspec, gpointer data)
+{
+	struct browser *b = data;
+	b->progress = webkit_web_view_get_progress (web_view) * 100;
+	update_title (b);
+}
+// the first expose after the page commits: content, not the blank view
+static gboolean
+first_paint_cb(GtkWidget *widget, GdkEventExpose *event, gpointer data)
+{
+	struct browser *b = data;
+	if (!b->opened || !b->committed) return FALSE;
+	unsigned long long t = now_ns() - b->opened;
+	meter_add(&first_paint_meter, t);
+	if (flag_verbose)
+		fprintf(stderr, "first paint: %.1fms %s\n", t / 1e6, webkit_web_view_get_uri(b->view));
+	if (!startup_reported) startup_report(webkit_web_view_get_uri(b->view));
+	b->opened = 0;
+	return FALSE;
+}
+static void
+destroy_cb (GtkWidget* widget, gpointer data)
+{
+	struct browser *b = data;
+	guint i;
+	browsers = g_list_remove(browsers, b);
+	if (b->hints)
+	{
+		for (i = 0; i < b->hints->len; i++)
+			g_object_unref(g_array_index(b->hints, struct hint, i).element);
+		g_array_free(b->hints, TRUE);
+	}
+	if (b->hint_keys) g_string_free(b->hint_keys, TRUE);
+	page_end(b);
+	g_free(b->title);
+	g_free(b->host);
+	g_free(b);
+	if (browsers) return;
+	if (downloads_pending()) fprintf(stderr, "meme: last window closed, finishing downloads\n");
+	else gtk_main_quit ();
+}
+static void
+go_home_cb (GtkWidget* widget, gpointer data)
+{
+	struct browser *b = data;
+	webkit_web_view_load_uri (b->view, HOMEPAGE);
+}
+static void
+go_back_cb (GtkWidget* widget, gpointer data)
+{
+	struct browser *b = data;
+	if (webkit_web_view_can_go_back(b->view))
+		webkit_web_view_go_back_or_forward(b->view, -1);
+	else gtk_widget_destroy(b->window);
+}
+static void
+go_forward_cb (GtkWidget* widget, gpointer data)
+{
+	struct browser *b = data;
+	webkit_web_view_go_back_or_forward(b->view, 1);
+}
+static void
+go_reload_cb (GtkWidget* widget, gpointer data)
+{
+	struct browser *b = data;
+	webkit_web_view_reload_bypass_cache(b->view);
+}
+gboolean
+download_request_cb(WebKitWebView *view, WebKitDownload *o, gpointer data)
+{
+	char *buf = getcwd(NULL, 0);
+	if (download_add(downloads, webkit_download_get_uri(o), webkit_web_view_get_uri(view),
+		buf ? buf: ".", webkit_download_get_suggested_filename(o)))
+		fprintf(stderr, "could not download: %s\n", webkit_download_get_uri(o));
+	free(buf);
+	// webkit's own download is cancelled; ours runs on the same session
+	return FALSE;
+}
+gboolean
+mime_type_policy_decision_requested_cb(WebKitWebView* view, WebKitWebFrame* frame, WebKitNetworkRequest* request, const char* mime_type, WebKitWebPolicyDecision* decision, gpointer data)
+{
+	struct browser *b = data;
+	if (!webkit_web_view_can_show_mime_type(view, mime_type))
+	{
+		// the page stays, so put its settings back
+		if (frame == webkit_web_view_get_main_frame(view))
+			apply_policy(b, webkit_web_view_get_uri(view));
+		webkit_web_policy_decision_download(decision);
+		return TRUE;
+	}
+	return FALSE;
+}
+// settings belong to the whole page, so the main frame's document decides
+// them, before it is requested
+gboolean
+navigation_policy_decision_requested_cb(WebKitWebView *view, WebKitWebFrame *frame, WebKitNetworkRequest *req, WebKitWebNavigationAction *nav, WebKitWebPolicyDecision *decision, gpointer data)
+{
+	struct browser *b = data;
+	if (frame == webkit_web_view_get_main_frame(view))
+		apply_policy(b, webkit_network_request_get_uri(req));
+	return FALSE;
+}
+struct browser* browser_new(const char *uri, unsigned long long opened);
+gboolean standby_take(const char *uri, unsigned long long opened);
+void standby_fill();
+void
+open_new_window(const char *uri)
+{
+	unsigned long long opened = now_ns();
+	if (flag_single) browser_new(uri, opened);
+	else
+	if (!standby_take(uri, opened))
+	{
+		// the pool is empty: pay for a cold start, and refill it
+		char t[48];
+		const char *env[] = { t, NULL };
+		sprintf(t, "MEME_OPENED=%llu", opened);
+		spawn(NEWWINDOW(uri), env);
+		standby_fill();
+	}
+}
+gboolean
+new_window_policy_decision_requested_cb(WebKitWebView *view, WebKitWebFrame *frame, WebKitNetworkRequest *req, WebKitWebNavigationAction *nav, WebKitWebPolicyDecision *decision, gpointer data)
+{
+	if (webkit_web_navigation_action_get_reason(nav) == WEBKIT_WEB_NAVIGATION_REASON_LINK_CLICKED)
+	{
+		webkit_web_policy_decision_ignore(decision);
+		open_new_window(webkit_network_request_get_uri(req));
+		return TRUE;
+	}
+	return FALSE;
+}
+WebKitWebView*
+create_web_view_cb(WebKitWebView *web_view, WebKitWebFrame *frame, gpointer data)
+{
+	struct browser *b = data;
+	open_new_window(gtk_entry_get_text(GTK_ENTRY(b->entry)));
+	return NULL;
+}
+// link hints: number the links and form fields in the viewport, drawn over
+// the web view rather than injected into the page, and pick one by typing
+static struct meter hints_meter = METER("link hints", "ns");
+
+static void
+element_position(WebKitDOMElement *e, GHashTable *seen, glong *x, glong *y)
+{
+	glong *p = g_hash_table_lookup(seen, e);
+	if (p) { *x = p[0]; *y = p[1]; return; }
+
+	glong px = 0, py = 0;
+	WebKitDOMElement *parent = webkit_dom_element_get_offset_parent(e);
+	if (parent) element_position(parent, seen, &px, &py);
+	*x = px + webkit_dom_element_get_offset_left(e);
+	*y = py + webkit_dom_element_get_offset_top(e);
+
+	p = g_new(glong, 2);
+	p[0] = *x; p[1] = *y;
+	g_hash_table_insert(seen, e, p);
+}
+void
+hints_clear(struct browser *b)
+{
+	guint i;
+	if (!b->hints) return;
+	for (i = 0; i < b->hints->len; i++)
+		g_object_unref(g_array_index(b->hints, struct hint, i).element);
+	g_array_free(b->hints, TRUE);
+	b->hints = NULL;
+	gtk_widget_queue_draw(GTK_WIDGET(b->view));
+}
+void
+hints_start(struct browser *b)
+{
+	hints_clear(b);
+	WebKitDOMDocument *doc = webkit_web_view_get_dom_document(b->view);
+	if (!doc) return;
+
+	unsigned long long t = now_ns();
+	WebKitDOMDOMWindow *win = webkit_dom_document_get_default_view(doc);
+	glong sx = webkit_dom_dom_window_get_scroll_x(win);
+	glong sy = webkit_dom_dom_window_get_scroll_y(win);
+	glong w = webkit_dom_dom_window_get_inner_width(win);
+	glong h = webkit_dom_dom_window_get_inner_height(win);
+
+	WebKitDOMNodeList *nodes = webkit_dom_document_query_selector_all(doc,
+		"a[href],input,textarea,select,button", NULL);
+	gulong i, n = nodes ? webkit_dom_node_list_get_length(nodes): 0;
+
+	// geometry only, no DOM writes in between: one layout serves every read.
+	// offset parents are shared, so each one's position is found once
+	GHashTable *seen = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+	b->hints = g_array_new(FALSE, FALSE, sizeof(struct hint));
+	for (i = 0; i < n; i++)
+	{
+		WebKitDOMElement *e = WEBKIT_DOM_ELEMENT(webkit_dom_node_list_item(nodes, i));
+		if (!webkit_dom_element_get_offset_width(e) && !webkit_dom_element_get_offset_height(e))
+			continue;
+		struct hint hint = { e, 0, 0 };
+		element_position(e, seen, &hint.x, &hint.y);
+		hint.x -= sx; hint.y -= sy;
+		if (hint.x + webkit_dom_element_get_offset_width(e) < 0 || hint.x >= w
+			|| hint.y + webkit_dom_element_get_offset_height(e) < 0 || hint.y >= h)
+			continue;
+		g_object_ref(e);
+		g_array_append_val(b->hints, hint);
+	}
+	g_hash_table_destroy(seen);
+	meter_add(&hints_meter, now_ns() - t);
+
+	if (!b->hints->len) { hints_clear(b); return; }
+	if (!b->hint_keys) b->hint_keys = g_string_new("");
+	g_string_truncate(b->hint_keys, 0);
+	gtk_widget_queue_draw(GTK_WIDGET(b->view));
+}
+static gboolean
+hints_expose_cb(GtkWidget *widget, GdkEventExpose *event, gpointer data)
+{
+	struct browser *b = data;
+	if (!b->hints) return FALSE;
+	cairo_t *cr = gdk_cairo_create(event->window);
+	cairo_select_font_face(cr, "sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+	cairo_set_font_size(cr, 10);
+
+	guint i; char label[16];
+	cairo_text_extents_t ext;
+	for (i = 0; i < b->hints->len; i++)
+	{
+		struct hint *hint = &g_array_index(b->hints, struct hint, i);
+		sprintf(label, "%u", i);
+		if (strstr(label, b->hint_keys->str) != label) continue;
+
+		cairo_text_extents(cr, label, &ext);
+		double x = MAX(hint->x - 10, 0), y = MAX(hint->y - 10, 0);
+		cairo_set_source_rgba(cr, 0, 0, 0, 0.7);
+		cairo_rectangle(cr, x, y, ext.x_advance + 8, ext.height + 6);
+		cairo_fill(cr);
+		cairo_set_source_rgb(cr, 0.93, 0.93, 0.93);
+		cairo_move_to(cr, x + 4, y + 3 - ext.y_bearing);
+		cairo_show_text(cr, label);
+	}
+	cairo_destroy(cr);
+	return FALSE;
+}
+void
+hints_follow(struct browser *b, guint n)
+{
+	WebKitDOMElement *e = g_object_ref(g_array_index(b->hints, struct hint, n).element);
+	hints_clear(b);
+
+	gchar *tag = webkit_dom_element_get_tag_name(e);
+	gchar *href = webkit_dom_element_get_attribute(e, "href");
+	gchar *type = webkit_dom_element_get_attribute(e, "type");
+	gchar *word = g_ascii_strdown(type && *type ? type: "text", -1);
+	gchar *pad = g_strdup_printf(" %s ", word);
+	gboolean anchor = !g_ascii_strcasecmp(tag, "a");
+	gboolean button = !g_ascii_strcasecmp(tag, "button")
+		|| strstr(" submit button reset image checkbox radio ", pad);
+
+	if (anchor && href && *href && g_ascii_strncasecmp(href, "javascript:", 11))
+	{
+		gchar *uri = webkit_dom_html_anchor_element_get_href(WEBKIT_DOM_HTML_ANCHOR_ELEMENT(e));
+		webkit_web_view_load_uri(b->view, uri);
+		g_free(uri);
+	}
+	else
+	if (!anchor && !button)
+	{
+		focus_web_view(b);
+		webkit_dom_element_focus(e);
+	}
+	else
+	{
+		// the equivalent of jQuery(e).click()
+		WebKitDOMDocument *doc = webkit_dom_node_get_owner_document(WEBKIT_DOM_NODE(e));
+		WebKitDOMEvent *click = webkit_dom_document_create_event(doc, "MouseEvents", NULL);
+		webkit_dom_mouse_event_init_mouse_event(WEBKIT_DOM_MOUSE_EVENT(click), "click", TRUE, TRUE,
+			webkit_dom_document_get_default_view(doc), 1, 0, 0, 0, 0, FALSE, FALSE, FALSE, FALSE, 0, NULL);
+		webkit_dom_node_dispatch_event(WEBKIT_DOM_NODE(e), click, NULL);
+		g_object_unref(click);
+	}
+	g_free(tag); g_free(href); g_free(type); g_free(word); g_free(pad);
+	g_object_unref(e);
+}
+// digits narrow the hints, Enter or an unambiguous number follows one
+gboolean
+hints_key(struct browser *b, guint k)
+{
+	guint n;
+	if (k == GDK_Escape) hints_clear(b);
+	else
+	if (k == GDK_BackSpace)
+	{
+		if (b->hint_keys->len) g_string_truncate(b->hint_keys, b->hint_keys->len-1);
+		gtk_widget_queue_draw(GTK_WIDGET(b->view));
+	}
+	else
+	if (k == GDK_Return || k == GDK_KP_Enter)
+	{
+		n = atoi(b->hint_keys->str);
+		if (b->hint_keys->len && n < b->hints->len) hints_follow(b, n);
+		else hints_clear(b);
+	}
+	else
+	if ((k >= GDK_0 && k <= GDK_9) || (k >= GDK_KP_0 && k <= GDK_KP_9))
+	{
+		g_string_append_c(b->hint_keys, '0' + (k >= GDK_KP_0 ? k - GDK_KP_0: k - GDK_0));
+		n = atoi(b->hint_keys->str);
+		if (n >= b->hints->len) g_string_truncate(b->hint_keys, b->hint_keys->len-1);
+		else if (n * 10 >= b->hints->len || !n) hints_follow(b, n);
+		else gtk_widget_queue_draw(GTK_WIDGET(b->view));
+	}
+	else
+	{
+		hints_clear(b);
+		return FALSE;
+	}
+	return TRUE;
+}
+void
+key_action(struct browser *b, const char *action)
+{
+	trace('B', "key", "action", 0, 0, action);
+	switch (key_action_find(action))
+	{
+		case ACTION_GO_HOME: go_home_cb(NULL, b); break;
+		case ACTION_GO_BACK: go_back_cb(NULL, b); break;
+		case ACTION_GO_FORWARD: go_forward_cb(NULL, b); break;
+		case ACTION_ZOOM_IN: webkit_web_view_zoom_in(b->view); break;
+		case ACTION_ZOOM_OUT: webkit_web_view_zoom_out(b->view); break;
+		case ACTION_ZOOM_RESET: webkit_web_view_set_zoom_level(b->view, 1.0); break;
+		case ACTION_TOGGLE_SOURCE: toggle_source_mode(b); break;
+		case ACTION_RELOAD_NOCACHE: webkit_web_view_reload_bypass_cache(b->view); break;
+		case ACTION_RUN_SCRIPTFILE: jsf(b, &run_script); break;
+		case ACTION_FOCUS_NAVBAR: focus_uri_entry(b); select_uri_entry(b); break;
+		case ACTION_NEW_WINDOW: open_new_window(HOMEPAGE); break;
+		case ACTION_PRINT_PAGE: webkit_web_frame_print(webkit_web_view_get_main_frame(b->view)); break;
+		case ACTION_FIND_TEXT: focus_uri_entry_search(b); break;
+		case ACTION_BOOKMARK_PAGE: focus_uri_entry_bookmark(b); break;
+		case ACTION_LINK_HINTS: hints_start(b); break;
+		default: fprintf(stderr, "unknown action: %s\n", action);
+	}
+	trace('E', "key", "action", 0, 0, NULL);
+}
+gboolean
+keypress_cb(GtkWidget* widget, GdkEventKey *ev, gpointer data)
+{
+	struct browser *b = data;
+	guint m = (ev->state & ~(GDK_MOD2_MASK));
+	guint k = gdk_keyval_to_lower(ev->keyval);
+	if (b->hints && !m && hints_key(b, k)) return TRUE;
+	if (!m && k == GDK_Escape)
+	{
+		default_uri_entry(b);
+		focus_web_view(b);
+	}
+	int i;
+	if ((i = key_find(keys, m, k)) >= 0) key_action(b, keys[i].action);
+	if ((i = key_find(jskeys, m, k)) >= 0)
+	{
+		inject_onload(b);
+		js(b, jskeys[i].action);
 	}
 	return FALSE;
 }
@@ -423,30 +1564,333 @@ inspector_create_cb (WebKitWebInspector* web_ins, WebKitWebView* page, gpointer
 
 	return WEBKIT_WEB_VIEW(new_web_view);
 }
-void add_cookie(SoupCookie *c)
+static gboolean
+flush_cookies_cb(gpointer data)
+{
+	cookie_flush_id = 0;
+	unsigned long long t = now_ns();
+	if (cookiejar_flush(cookie_jar))
+		fprintf(stderr, "could not write: %s\n", COOKIEFILE);
+	meter_add(&cookie_flush_meter, now_ns() - t);
+	return FALSE;
+}
+void
+add_cookie(SoupCookie *sc)
+{
+	struct cookie c = {
+		sc->name, sc->value, sc->domain, sc->path,
+		sc->expires ? soup_date_to_time_t(sc->expires): 0,
+		sc->secure, sc->http_only,
+	};
+	if (!c.expires && SESSIONTIME) c.expires = time(NULL) + SESSIONTIME;
+	cookiejar_add(cookie_jar, &c);
+}
+// a response for the archive being recorded, waiting on its body
+struct recorded {
+	char *key;
+	int status;
+	gchar *headers;
+	gsize headers_len;
+	unsigned long long latency;
+};
+static void
+recorded_free(struct recorded *r)
+{
+	free(r->key);
+	g_free(r->headers);
+	g_free(r);
+}
+// one message's milestones in ns, from queueing to finishing
+struct timing {
+	int ref;
+	struct page *page;  // referenced, if a window asked for the message
+	gchar *key;  // its URI, under which the window's resource finds it
+	gchar *host;
+	unsigned long long queued, resolving, resolved, connecting, connected, started, headers;
+	gboolean active;
+	gboolean finished;
+	gboolean revalidated;  // the cache's copy came back 304
+	gboolean traced, hold_traced;  // their spans began in the trace, so may end there
+	gboolean owed;  // by netem, for a body of unknown length
+	struct recorded *record;  // until the window's resource has the body
+};
+static void
+timing_unref(gpointer data)
+{
+	struct timing *t = data;
+	if (--t->ref) return;
+	if (t->page) page_unref(t->page);
+	if (t->record) recorded_free(t->record);
+	g_free(t->key);
+	g_free(t->host);
+	g_free(t);
+}
+// the oldest timing sent for the page under key
+static struct timing*
+requests_take(const char *key, struct page *p)
+{
+	GQueue *q = requests_sent ? g_hash_table_lookup(requests_sent, key): NULL;
+	GList *l;
+	for (l = q ? q->head: NULL; l && ((struct timing*)l->data)->page != p; l = l->next);
+	if (!l) return NULL;
+	struct timing *t = l->data;
+	link_remove(requests_sent, key, t);
+	return t;
+}
+static gboolean
+sent_drop_cb(gpointer key, gpointer value, gpointer data)
 {
-	if (!COOKIEFILE) return;
-	int lock = open(COOKIEFILE, 0);
-	if (!flock(lock, LOCK_EX))
+	GQueue *q = value;
+	GList *l, *next;
+	for (l = q->head; l; l = next)
 	{
-		SoupDate *e;
-		SoupCookieJar *j = soup_cookie_jar_text_new(COOKIEFILE, FALSE);
-		c = soup_cookie_copy(c);
-		if (c->expires == NULL && SESSIONTIME)
+		struct timing *t = l->data;
+		next = l->next;
+		if (t->page != data) continue;
+		g_queue_delete_link(q, l);
+		timing_unref(t);
+	}
+	return g_queue_is_empty(q);
+}
+// the page is over: whatever of it comes back now goes unclaimed
+static void
+requests_drop(struct page *p)
+{
+	if (requests_sent) g_hash_table_foreach_remove(requests_sent, sent_drop_cb, p);
+}
+// only messages that had to make a connection see these
+static void
+network_event_cb(SoupMessage *msg, GSocketClientEvent event, GIOStream *connection, gpointer data)
+{
+	struct timing *t = data;
+	unsigned long long now = now_ns();
+	switch (event) {
+	case G_SOCKET_CLIENT_RESOLVING:
+		if (!t->resolving) t->resolving = now;
+		break;
+	case G_SOCKET_CLIENT_RESOLVED:
+		t->resolved = now;
+		break;
+	case G_SOCKET_CLIENT_CONNECTING:
+		if (!t->connecting) t->connecting = now;
+		break;
+	case G_SOCKET_CLIENT_COMPLETE:
+		t->connected = now;
+		break;
+	default:
+		break;
+	}
+}
+static void
+request_finished_cb(SoupMessage *msg, gpointer data)
+{
+	struct timing *t = data;
+	struct page *p = t->page;
+	struct host_load *h = p && t->host ? g_hash_table_lookup(p->hosts, t->host): NULL;
+	unsigned long long now = now_ns(), d;
+
+	requests_active--;
+	t->finished = TRUE;
+	meter_add(&request_meter, now - t->queued);
+	if (t->resolving && t->resolved > t->resolving)
+	{
+		meter_add(&request_dns_meter, d = t->resolved - t->resolving);
+		if (p) p->dns += d;
+	}
+	if (t->connecting && t->connected > t->connecting)
+	{
+		meter_add(&request_connect_meter, d = t->connected - t->connecting);
+		if (p) { p->connect += d; p->connections++; }
+	}
+	if (t->started && t->headers > t->started)
+	{
+		meter_add(&request_ttfb_meter, d = t->headers - t->started);
+		if (p) p->ttfb += d;
+		meter_add(&request_transfer_meter, d = now - t->headers);
+		if (p) p->transfer += d;
+	}
+	if (trace_enabled)
+	{
+		char buf[32];
+		unsigned long id = (unsigned long)msg;
+		if (t->resolving && t->resolved > t->resolving)
+		{
+			trace('b', "net", "dns", id, t->resolving, t->host);
+			trace('e', "net", "dns", id, t->resolved, NULL);
+		}
+		if (t->connecting && t->connected > t->connecting)
+		{
+			trace('b', "net", "connect", id, t->connecting, t->host);
+			trace('e', "net", "connect", id, t->connected, NULL);
+		}
+		if (t->started && t->headers > t->started)
 		{
-			e = soup_date_new_from_time_t(time(NULL) + SESSIONTIME);
-			soup_cookie_set_expires(c, e);
+			trace('b', "net", "wait", id, t->started, NULL);
+			trace('e', "net", "wait", id, t->headers, NULL);
+			trace('b', "net", "transfer", id, t->headers, NULL);
+			trace('e', "net", "transfer", id, now, NULL);
 		}
-		soup_cookie_jar_add_cookie(j, c);
-		g_object_unref(j);
-		flock(lock, LOCK_UN);
-		close(lock);
+		snprintf(buf, sizeof(buf), "status %u", msg->status_code);
+		if (t->traced) trace('e', "net", "request", id, now, buf);
+	}
+	if (!p) return;
+	// webkit gets no response for these, so no resource would claim them
+	if ((SOUP_STATUS_IS_TRANSPORT_ERROR(msg->status_code) ||
+		(SOUP_STATUS_IS_REDIRECTION(msg->status_code) && msg->status_code != SOUP_STATUS_NOT_MODIFIED)) &&
+		link_remove(requests_sent, t->key, t))
+		timing_unref(t);
+	if (SOUP_STATUS_IS_TRANSPORT_ERROR(msg->status_code) || msg->status_code >= 400) p->failed++;
+	if (t->active)
+	{
+		p->active--;
+		if (h) h->active--;
+		t->active = FALSE;
+	}
+}
+// soup follows a redirect on the same message, and the resource moves on
+// to the new URI with it
+static void
+request_restarted_cb(SoupMessage *msg, gpointer data)
+{
+	struct timing *t = data;
+	gchar *key = request_key(soup_message_get_uri(msg));
+	if (strcmp(key, t->key) && link_remove(requests_sent, t->key, t))
+		link_push(&requests_sent, key, t);
+	g_free(t->key);
+	t->key = key;
+}
+// before any connection is made for it, so before request_start_cb. fresh
+// cache hits never get here
+void
+request_queued_cb(SoupSession *s, SoupMessage *msg, gpointer v)
+{
+	struct timing *t = g_new0(struct timing, 1);
+	t->ref = 1;
+	t->queued = now_ns();
+	t->key = request_key(soup_message_get_uri(msg));
+	// a preconnect's HEAD of the root was asked for by no window
+	if (!g_object_get_data(G_OBJECT(msg), "meme-preconnect")) t->page = link_pop(pages_wanted, t->key);
+	requests_active++;
+	t->host = g_strdup(soup_message_get_uri(msg)->host);
+	g_object_set_data_full(G_OBJECT(msg), "meme-timing", t, timing_unref);
+	if (t->page)
+	{
+		t->ref++;
+		link_push(&requests_sent, t->key, t);
+		g_signal_connect(G_OBJECT(msg), "restarted", G_CALLBACK(request_restarted_cb), t);
+	}
+	if (trace_enabled)
+	{
+		char *uri = soup_uri_to_string(soup_message_get_uri(msg), FALSE);
+		trace('b', "net", "request", (unsigned long)msg, t->queued, uri);
+		t->traced = TRUE;
+		g_free(uri);
+	}
+	g_signal_connect(G_OBJECT(msg), "network-event", G_CALLBACK(network_event_cb), t);
+	g_signal_connect(G_OBJECT(msg), "finished", G_CALLBACK(request_finished_cb), t);
+}
+// on the wire: counts toward the page's concurrency, per host and overall
+static void
+timing_started(struct timing *t)
+{
+	struct page *p = t->page;
+	t->started = now_ns();
+	if (!p || !t->host || t->active) return;
+	struct host_load *h = g_hash_table_lookup(p->hosts, t->host);
+	if (!h)
+	{
+		h = g_new0(struct host_load, 1);
+		g_hash_table_insert(p->hosts, g_strdup(t->host), h);
+	}
+	t->active = TRUE;
+	h->requests++;
+	if (++h->active > h->peak) h->peak = h->active;
+	if (++p->active > p->peak) p->peak = p->active;
+}
+// the response headers worth replaying. bodies are stored decoded and
+// whole, so their framing and encoding go
+static gchar*
+record_headers(SoupMessage *msg, gsize *len)
+{
+	static const char *skip[] = { "Content-Length", "Content-Encoding", "Transfer-Encoding", "Connection", NULL };
+	GString *s = g_string_new(NULL);
+	SoupMessageHeadersIter iter;
+	const char *name, *value;
+	int i;
+	soup_message_headers_iter_init(&iter, msg->response_headers);
+	while (soup_message_headers_iter_next(&iter, &name, &value))
+	{
+		for (i = 0; skip[i] && g_ascii_strcasecmp(name, skip[i]); i++);
+		if (!skip[i]) g_string_append_printf(s, "%s: %s\n", name, value);
 	}
-	else fprintf(stderr, "could not read: %s\n", COOKIEFILE);
+	*len = s->len;
+	return g_string_free(s, FALSE);
+}
+// msg's response as the archive will keep it, with the time it took to
+// arrive. called from got-headers, on the session's own message
+static struct recorded*
+record_start(SoupMessage *msg, struct timing *t)
+{
+	struct recorded *r = g_new0(struct recorded, 1);
+	char *uri = soup_uri_to_string(soup_message_get_uri(msg), FALSE);
+	r->key = archive_key(msg->method, uri, msg->request_body->data, msg->request_body->length);
+	r->status = msg->status_code;
+	r->headers = record_headers(msg, &r->headers_len);
+	r->latency = t && t->headers > t->queued ? t->headers - t->queued: 0;
+	g_free(uri);
+	return r;
+}
+// store it with its body, and free it
+static void
+record_finish(struct recorded *r, const void *body, size_t len)
+{
+	int rc = archive_add(recording, r->key, r->status, r->headers, r->headers_len, body, len, r->latency);
+	if (rc < 0) fprintf(stderr, "could not record: %s\n", r->key);
+	if (!rc) meter_add(&record_meter, len);
+	recorded_free(r);
+}
+static gboolean
+netem_unpause_cb(gpointer data)
+{
+	SoupMessage *msg = data;
+	struct timing *t = g_object_get_data(G_OBJECT(msg), "meme-timing");
+	if (t && t->hold_traced) trace('e', "net", "netem", (unsigned long)msg, 0, NULL);
+	if (t && !t->finished) soup_session_unpause_message(webkit_get_default_session(), msg);
+	g_object_unref(msg);
+	return FALSE;
+}
+// hold the response back as a slow link would have. the body's length is
+// charged to the link now when known, otherwise once it has gone by
+static void
+netem_response(SoupMessage *msg, struct timing *t)
+{
+	unsigned long long len = 0, now = now_ns();
+	if (soup_message_headers_get_encoding(msg->response_headers) == SOUP_ENCODING_CONTENT_LENGTH)
+		len = soup_message_headers_get_content_length(msg->response_headers);
+	else if (t) t->owed = TRUE;
+	unsigned long long hold = netem_hold(&netem, len, now);
+	meter_add(&netem_meter, hold);
+	if (hold < 1000000) return;
+	trace('b', "net", "netem", (unsigned long)msg, now, NULL);
+	if (t) t->hold_traced = trace_enabled;
+	soup_session_pause_message(webkit_get_default_session(), msg);
+	g_timeout_add(hold / 1000000, netem_unpause_cb, g_object_ref(msg));
 }
 void
 got_headers_cb(SoupMessage *msg, gpointer v)
 {
+	struct timing *t = g_object_get_data(G_OBJECT(msg), "meme-timing");
+	if (t) t->headers = now_ns();
+	if (netem_active(&netem)) netem_response(msg, t);
+	// webkit never sees a redirect as a resource of its own. the rest wait
+	// for their bodies, which only the window's resource gets whole
+	if (recording && SOUP_STATUS_IS_REDIRECTION(msg->status_code) && msg->status_code != SOUP_STATUS_NOT_MODIFIED)
+		record_finish(record_start(msg, t), NULL, 0);
+	else if (recording && t && t->page && !t->record &&
+		(SOUP_STATUS_IS_SUCCESSFUL(msg->status_code) || msg->status_code == SOUP_STATUS_NOT_MODIFIED))
+		t->record = record_start(msg, t);
+	if (t && msg->status_code == SOUP_STATUS_NOT_MODIFIED) t->revalidated = TRUE;
+	if (!cookie_jar) return;
 	GSList *l, *p;
 	for(p = l = soup_cookies_from_response(msg); p; p = g_slist_next(p))
 	{
@@ -454,25 +1898,202 @@ got_headers_cb(SoupMessage *msg, gpointer v)
 		add_cookie(c);
 	}
 	soup_cookies_free(l);
+	if (cookiejar_pending(cookie_jar) && !cookie_flush_id)
+		cookie_flush_id = g_timeout_add(COOKIEFLUSH, flush_cookies_cb, NULL);
 }
 void
 request_start_cb(SoupSession *s, SoupMessage *msg, gpointer v)
 {
 	SoupMessageHeaders *h = msg->request_headers;
+	struct timing *timing = g_object_get_data(G_OBJECT(msg), "meme-timing");
+	if (timing) timing_started(timing);
 	soup_message_headers_remove(h, "Cookie");
 	SoupURI *uri = soup_message_get_uri(msg);
-	SoupCookieJar *j = soup_cookie_jar_text_new(COOKIEFILE, TRUE);
-	const char *c = soup_cookie_jar_get_cookies(j, uri, TRUE);
-	g_object_unref(j);
-	if (c) soup_message_headers_append(h, "Cookie", c);
+	if (!g_object_get_data(G_OBJECT(msg), "meme-preconnect")) preconnect_used(uri->host);
+	if (cookie_jar && uri->host)
+	{
+		unsigned long long t = now_ns();
+		if (cookiejar_sync(cookie_jar))
+		{
+			unsigned long long r = now_ns();
+			meter_add(&cookie_reload_meter, r - t);
+			t = r;
+		}
+		char *c = cookiejar_header(cookie_jar, uri->host, uri->path,
+			uri->scheme == SOUP_URI_SCHEME_HTTPS);
+		meter_add(&cookie_lookup_meter, now_ns() - t);
+		if (c) soup_message_headers_append(h, "Cookie", c);
+		free(c);
+	}
 	g_signal_connect_after(G_OBJECT(msg), "got-headers", G_CALLBACK(got_headers_cb), NULL);
 }
+// a main frame document starts a new page for !stats, and every request
+// leaves the page for its message to pick up. blocked subresources turn into
+// about:blank before anything is sent; the page itself is never blocked: it
+// was asked for
+static void
+resource_request_cb(WebKitWebView *view, WebKitWebFrame *frame, WebKitWebResource *resource,
+	WebKitNetworkRequest *request, WebKitNetworkResponse *response, gpointer data)
+{
+	struct browser *b = data;
+	const char *uri = webkit_network_request_get_uri(request);
+	if (!uri || strncmp(uri, "http", 4)) return;
+	gboolean page = FALSE;
+	if (frame == webkit_web_view_get_main_frame(view))
+	{
+		WebKitWebDataSource *ds = webkit_web_frame_get_provisional_data_source(frame);
+		WebKitNetworkRequest *main = ds ? webkit_web_data_source_get_initial_request(ds): NULL;
+		page = main && !g_strcmp0(webkit_network_request_get_uri(main), uri);
+	}
+	if (replaying && !strncmp(uri, "https://", 8))
+	{
+		// to the replay proxy, which can't answer from inside TLS
+		gchar *plain = g_strconcat("http://", uri+8, NULL);
+		webkit_network_request_set_uri(request, plain);
+		g_free(plain);
+		uri = webkit_network_request_get_uri(request);
+	}
+	if (page)
+	{
+		page_end(b);
+		b->page = page_new(uri);
+	}
+	if (!page && blocker && b->block)
+	{
+		unsigned long long t = now_ns();
+		int blocked = blocker_match(blocker, uri, b->host);
+		meter_add(&block_check_meter, now_ns() - t);
+		if (blocked)
+		{
+			webkit_network_request_set_uri(request, "about:blank");
+			b->blocked++;
+			update_title(b);
+			return;
+		}
+	}
+	if (!b->page) return;
+	b->page->requests++;
+	gchar *key = request_key_str(uri);
+	link_push(&pages_wanted, key, page_ref(b->page));
+	g_object_set_data_full(G_OBJECT(resource), "meme-key", key, g_free);
+}
+// a resource webkit had in memory sends no message, so nothing took its page
+static void
+resource_done(struct browser *b, WebKitWebResource *resource)
+{
+	const char *key = g_object_get_data(G_OBJECT(resource), "meme-key");
+	if (key && b->page && link_remove(pages_wanted, key, b->page)) page_unref(b->page);
+}
+// hit, revalidated or miss, by whether and how a message for the resource
+// went to the network
+static void
+resource_response_cb(WebKitWebView *view, WebKitWebFrame *frame, WebKitWebResource *resource,
+	WebKitNetworkResponse *response, gpointer data)
+{
+	struct browser *b = data;
+	SoupMessage *msg = webkit_network_response_get_message(response);
+	const char *key = g_object_get_data(G_OBJECT(resource), "meme-key");
+	if (!msg || !key) return;
+	struct timing *t = requests_take(key, b->page);
+	if (t) g_object_set_data_full(G_OBJECT(resource), "meme-timing", t, timing_unref);
+	// a revalidated body is the cached one, as good as a 200, and the 304
+	// carried only some of its headers. webkit's copy has them all
+	if (t && t->record && t->record->status == SOUP_STATUS_NOT_MODIFIED)
+	{
+		g_free(t->record->headers);
+		t->record->headers = record_headers(msg, &t->record->headers_len);
+		t->record->status = SOUP_STATUS_OK;
+	}
+	if (!http_cache) return;
+	g_object_set_data(G_OBJECT(resource), "meme-cache", !t ? "hit": t->revalidated ? "revalidated": "miss");
+	if (!t && b->page) b->page->cached++;
+}
+static void
+resource_finished_cb(WebKitWebView *view, WebKitWebFrame *frame, WebKitWebResource *resource, gpointer data)
+{
+	struct browser *b = data;
+	const char *kind = g_object_get_data(G_OBJECT(resource), "meme-cache");
+	GString *body = webkit_web_resource_get_data(resource);
+	resource_done(b, resource);
+	unsigned long long len = body ? body->len: 0;
+	if (b->page) b->page->bytes += len;
+	struct timing *t = g_object_get_data(G_OBJECT(resource), "meme-timing");
+	// webkit reads the body through a stream, past got-chunk, so its length
+	// is first known here
+	if (t && t->owed)
+	{
+		netem_charge(&netem, len, now_ns());
+		t->owed = FALSE;
+	}
+	if (t && t->record)
+	{
+		record_finish(t->record, body ? body->str: NULL, len);
+		t->record = NULL;
+	}
+	if (!kind) return;
+	if (!strcmp(kind, "hit")) meter_add(&cache_hit_meter, len);
+	else if (!strcmp(kind, "revalidated")) meter_add(&cache_revalidated_meter, len);
+	else meter_add(&cache_miss_meter, len);
+}
+static void
+resource_failed_cb(WebKitWebView *view, WebKitWebFrame *frame, WebKitWebResource *resource, GError *error,
+	gpointer data)
+{
+	resource_done(data, resource);
+}
+// SoupCache keeps its index in memory and rewrites it whole on exit, so
+// processes cannot share one directory. each takes the first of CACHESLOTS
+// directories nobody holds, and keeps it until exit; the long-lived first
+// window and the standby pool end up reusing the same warm ones
+static void
+apply_cache(SoupSession *soup)
+{
+	char dir[BLOCK], lock[BLOCK];
+	int slot;
+	if (!CACHEDIR || CACHESIZE <= 0) return;
+	for (slot = 0; slot < CACHESLOTS; slot++)
+	{
+		snprintf(dir, sizeof(dir), "%s%d", CACHEDIR, slot);
+		snprintf(lock, sizeof(lock), "%s/lock", dir);
+		g_mkdir_with_parents(dir, 0700);
+		http_cache_lock = open(lock, O_RDWR|O_CREAT|O_CLOEXEC, 0600);
+		if (http_cache_lock >= 0 && !flock(http_cache_lock, LOCK_EX|LOCK_NB)) break;
+		if (http_cache_lock >= 0) close(http_cache_lock);
+		http_cache_lock = -1;
+	}
+	if (slot == CACHESLOTS) return;
+
+	http_cache = soup_cache_new(dir, SOUP_CACHE_SINGLE_USER);
+	soup_cache_set_max_size(http_cache, CACHESIZE / CACHESLOTS);
+	soup_cache_load(http_cache);
+	soup_session_add_feature(soup, SOUP_SESSION_FEATURE(http_cache));
+	meter_register(&cache_hit_meter);
+	meter_register(&cache_revalidated_meter);
+	meter_register(&cache_miss_meter);
+}
 void
-onload_event_cb(WebKitWebView *web_view, WebKitWebFrame *frame, gpointer user_data)
+onload_event_cb(WebKitWebView *web_view, WebKitWebFrame *frame, gpointer data)
 {
-	jsf_frame(ONLOADFILE, frame);
-	default_uri_entry();
-	focus_web_view();
+	struct browser *b = data;
+	if (ONLOADINJECT == INJECT_ALL_FRAMES)
+	{
+		jsf_frame(&onload_script, frame);
+		if (frame == webkit_web_view_get_main_frame(web_view)) b->onload_injected = TRUE;
+	}
+	else
+	if (ONLOADINJECT == INJECT_MAIN_FRAME && frame == webkit_web_view_get_main_frame(web_view))
+		inject_onload(b);
+	struct page *p = b->page;
+	if (frame == webkit_web_view_get_main_frame(web_view))
+		trace('i', "load", "onload", 0, 0, webkit_web_view_get_uri(web_view));
+	if (bench && frame == webkit_web_view_get_main_frame(web_view)) bench_onload(b);
+	if (p && p->committed && !p->loaded && frame == webkit_web_view_get_main_frame(web_view))
+	{
+		p->loaded = now_ns();
+		meter_add(&page_load_meter, p->loaded - p->committed);
+	}
+	default_uri_entry(b);
+	focus_web_view(b);
 }
 void
 print_requested_cb(WebKitWebView *web_view, GtkMenu *menu, gpointer user_data)
@@ -480,61 +2101,90 @@ print_requested_cb(WebKitWebView *web_view, GtkMenu *menu, gpointer user_data)
 	webkit_web_frame_print(webkit_web_view_get_main_frame(web_view));
 }
 static gboolean
-match_selected_cb(GtkEntryCompletion *widget, GtkTreeModel *model, GtkTreeIter *iter, gpointer v)
+match_selected_cb(GtkEntryCompletion *widget, GtkTreeModel *model, GtkTreeIter *iter, gpointer data)
 {
+	struct browser *b = data;
 	GValue value = {0, };
 	gtk_tree_model_get_value(model, iter, 0, &value);
-	gtk_entry_set_text (GTK_ENTRY (uri_entry), g_value_get_string(&value));
+	gtk_entry_set_text (GTK_ENTRY (b->entry), g_value_get_string(&value));
 	g_value_unset(&value);
-	activate_uri_entry_cb(uri_entry, NULL);
-	return FALSE;
+	activate_uri_entry_cb(b->entry, b);
+	// setting the text refilled the model under iter: the default handler
+	// must not touch it, and has nothing left to do
+	return TRUE;
 }
 static gboolean
 uri_entry_match_cb(GtkEntryCompletion *completion, const gchar *key, GtkTreeIter *iter, gpointer user_data)
 {
-	GValue value = {0, };
-	gtk_tree_model_get_value(GTK_TREE_MODEL(uri_model), iter, 0, &value);
-	gboolean flag = !strchr("!/", key[0]) && strstr(g_value_get_string(&value), key) ? TRUE : FALSE;
-	g_value_unset(&value);
-	return flag;
+	// the model only ever holds the ranked matches for the current text
+	return !strchr("!/", key[0]);
+}
+static void
+changed_uri_entry_cb(GtkEditable *editable, gpointer data)
+{
+	struct browser *b = data;
+	// link_hover_cb and friends rewrite the entry too; only typing completes
+	if (!gtk_widget_has_focus(b->entry)) return;
+
+	const gchar *key = gtk_entry_get_text(GTK_ENTRY(b->entry));
+	const char *matches[COMPLETIONS];
+	int i, n = 0;
+
+	unsigned long long t = now_ns();
+	if (key[0] && !strchr("!/", key[0]))
+		n = completion_match(uri_index, key, matches, COMPLETIONS);
+	meter_add(&completion_meter, now_ns() - t);
+
+	gtk_list_store_clear(b->matches);
+	for (i = 0; i < n; i++)
+		gtk_list_store_insert_with_values(b->matches, NULL, -1, 0, matches[i], -1);
+	preconnect(n ? matches[0]: NULL);
+	prefetch(n ? matches[0]: NULL);
 }
 static GtkWidget*
-create_browser ()
+create_browser (struct browser *b)
 {
 	GtkWidget* scrolled_window = gtk_scrolled_window_new (NULL, NULL);
 	gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scrolled_window), GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
 
-	web_view = WEBKIT_WEB_VIEW (webkit_web_view_new ());
-	gtk_container_add (GTK_CONTAINER (scrolled_window), GTK_WIDGET (web_view));
-
-	g_signal_connect(web_view, "notify::title", G_CALLBACK (notify_title_cb), web_view);
-	g_signal_connect(web_view, "notify::load-status", G_CALLBACK (notify_load_status_cb), web_view);
-	g_signal_connect(web_view, "notify::progress", G_CALLBACK (notify_progress_cb), web_view);
-	g_signal_connect(web_view, "download-requested", G_CALLBACK(download_request_cb), web_view);
-	g_signal_connect(web_view, "hovering-over-link", G_CALLBACK (link_hover_cb), web_view);
-	g_signal_connect(web_view, "create-web-view", G_CALLBACK(create_web_view_cb), web_view);
-	g_signal_connect(web_view, "onload-event", G_CALLBACK(onload_event_cb), web_view);
-	g_signal_connect(web_view, "print-requested", G_CALLBACK(print_requested_cb), web_view);
-	g_signal_connect(web_view, "mime-type-policy-decision-requested", G_CALLBACK(mime_type_policy_decision_requested_cb), web_view);
-	g_signal_connect(web_view, "new-window-policy-decision-requested", G_CALLBACK(new_window_policy_decision_requested_cb), web_view);
-
-	web_settings = webkit_web_view_get_settings(web_view);
-	g_object_set(G_OBJECT(web_settings), "user-agent", USERAGENT, NULL);
-	g_object_set(G_OBJECT(web_settings), "user-stylesheet-uri", STYLEFILE, NULL);
-	g_object_set(G_OBJECT(web_settings), "enable-developer-extras", TRUE, NULL);
-	g_object_set(G_OBJECT(web_settings), "enable-spell-checking", TRUE, NULL);
-	g_object_set(G_OBJECT(web_settings), "enable-plugins", flag_plugins, NULL);
-	g_object_set(G_OBJECT(web_settings), "javascript-can-open-windows-automatically", FALSE, NULL);
-	g_object_set(G_OBJECT(web_settings), "enable-html5-local-storage", TRUE, NULL);
-	g_object_set(G_OBJECT(web_settings), "html5-local-storage-database-path", MEMEDIR, NULL);
-
-	web_inspector = webkit_web_view_get_inspector(web_view);
+	b->view = WEBKIT_WEB_VIEW (webkit_web_view_new ());
+	gtk_container_add (GTK_CONTAINER (scrolled_window), GTK_WIDGET (b->view));
+
+	WebKitWebView *web_view = b->view;
+	g_signal_connect(web_view, "notify::title", G_CALLBACK (notify_title_cb), b);
+	g_signal_connect(web_view, "notify::load-status", G_CALLBACK (notify_load_status_cb), b);
+	g_signal_connect(web_view, "notify::progress", G_CALLBACK (notify_progress_cb), b);
+	g_signal_connect(web_view, "download-requested", G_CALLBACK(download_request_cb), b);
+	g_signal_connect(web_view, "resource-request-starting", G_CALLBACK(resource_request_cb), b);
+	g_signal_connect(web_view, "resource-response-received", G_CALLBACK(resource_response_cb), b);
+	g_signal_connect(web_view, "resource-load-finished", G_CALLBACK(resource_finished_cb), b);
+	g_signal_connect(web_view, "resource-load-failed", G_CALLBACK(resource_failed_cb), b);
+	g_signal_connect(web_view, "hovering-over-link", G_CALLBACK (link_hover_cb), b);
+	g_signal_connect(web_view, "create-web-view", G_CALLBACK(create_web_view_cb), b);
+	g_signal_connect(web_view, "onload-event", G_CALLBACK(onload_event_cb), b);
+	g_signal_connect(web_view, "print-requested", G_CALLBACK(print_requested_cb), b);
+	g_signal_connect(web_view, "navigation-policy-decision-requested", G_CALLBACK(navigation_policy_decision_requested_cb), b);
+	g_signal_connect(web_view, "mime-type-policy-decision-requested", G_CALLBACK(mime_type_policy_decision_requested_cb), b);
+	g_signal_connect(web_view, "new-window-policy-decision-requested", G_CALLBACK(new_window_policy_decision_requested_cb), b);
+	g_signal_connect_after(web_view, "expose-event", G_CALLBACK(hints_expose_cb), b);
+	g_signal_connect_after(web_view, "expose-event", G_CALLBACK(first_paint_cb), b);
+
+	b->settings = webkit_web_view_get_settings(web_view);
+	g_object_set(G_OBJECT(b->settings), "user-agent", USERAGENT, NULL);
+	g_object_set(G_OBJECT(b->settings), "user-stylesheet-uri", STYLEFILE, NULL);
+	g_object_set(G_OBJECT(b->settings), "enable-developer-extras", TRUE, NULL);
+	g_object_set(G_OBJECT(b->settings), "javascript-can-open-windows-automatically", FALSE, NULL);
+	g_object_set(G_OBJECT(b->settings), "enable-html5-local-storage", TRUE, NULL);
+	g_object_set(G_OBJECT(b->settings), "html5-local-storage-database-path", MEMEDIR, NULL);
+	apply_policy(b, NULL);
+
+	WebKitWebInspector *web_inspector = webkit_web_view_get_inspector(web_view);
 	g_signal_connect (G_OBJECT (web_inspector), "inspect-web-view", G_CALLBACK (inspector_create_cb), NULL);
 
 	return scrolled_window;
 }
 static GtkWidget*
-create_toolbar ()
+create_toolbar (struct browser *b)
 {
 	GtkWidget* toolbar = gtk_toolbar_new ();
 
@@ -549,93 +2199,907 @@ create_toolbar ()
 
 	// the back button
 	item = gtk_tool_button_new_from_stock (GTK_STOCK_GO_BACK);
-	g_signal_connect (G_OBJECT (item), "clicked", G_CALLBACK (go_back_cb), NULL);
+	g_signal_connect (G_OBJECT (item), "clicked", G_CALLBACK (go_back_cb), b);
 	gtk_toolbar_insert (GTK_TOOLBAR (toolbar), item, -1);
 
 	// The forward button
 	item = gtk_tool_button_new_from_stock (GTK_STOCK_GO_FORWARD);
-	g_signal_connect (G_OBJECT (item), "clicked", G_CALLBACK (go_forward_cb), NULL);
+	g_signal_connect (G_OBJECT (item), "clicked", G_CALLBACK (go_forward_cb), b);
 	gtk_toolbar_insert (GTK_TOOLBAR (toolbar), item, -1);
 
 	// The reload button
 	item = gtk_tool_button_new_from_stock (GTK_STOCK_REFRESH);
-	g_signal_connect (G_OBJECT (item), "clicked", G_CALLBACK (go_reload_cb), NULL);
+	g_signal_connect (G_OBJECT (item), "clicked", G_CALLBACK (go_reload_cb), b);
 	gtk_toolbar_insert (GTK_TOOLBAR (toolbar), item, -1);
 
 	// The home button
 	item = gtk_tool_button_new_from_stock (GTK_STOCK_HOME);
-	g_signal_connect (G_OBJECT (item), "clicked", G_CALLBACK (go_home_cb), NULL);
+	g_signal_connect (G_OBJECT (item), "clicked", G_CALLBACK (go_home_cb), b);
 	gtk_toolbar_insert (GTK_TOOLBAR (toolbar), item, -1);
 
 	// The URL entry
 	item = gtk_tool_item_new ();
 	gtk_tool_item_set_expand (item, TRUE);
-	uri_entry = gtk_entry_new ();
-	gtk_container_add (GTK_CONTAINER (item), uri_entry);
-	g_signal_connect (G_OBJECT (uri_entry), "activate", G_CALLBACK (activate_uri_entry_cb), NULL);
-	g_signal_connect (G_OBJECT (uri_entry), "focus-in-event", G_CALLBACK (focus_in_uri_entry_cb), NULL);
+	b->entry = gtk_entry_new ();
+	gtk_container_add (GTK_CONTAINER (item), b->entry);
+	g_signal_connect (G_OBJECT (b->entry), "activate", G_CALLBACK (activate_uri_entry_cb), b);
+	g_signal_connect (G_OBJECT (b->entry), "focus-in-event", G_CALLBACK (focus_in_uri_entry_cb), b);
+	// before the completion's own handler, so it filters fresh matches
+	g_signal_connect (G_OBJECT (b->entry), "changed", G_CALLBACK (changed_uri_entry_cb), b);
 
 	// bookmark completion
-	uri_completion = gtk_entry_completion_new();
-	gtk_entry_completion_set_text_column(uri_completion, 0);
-	gtk_entry_set_completion(GTK_ENTRY(uri_entry), uri_completion);
-	gtk_entry_completion_set_match_func (uri_completion, uri_entry_match_cb, NULL, NULL);
-	g_signal_connect(G_OBJECT (uri_completion), "match-selected", G_CALLBACK (match_selected_cb), NULL);
+	b->matches = gtk_list_store_new(1, G_TYPE_STRING);
+	b->completion = gtk_entry_completion_new();
+	gtk_entry_completion_set_model(b->completion, GTK_TREE_MODEL(b->matches));
+	g_object_unref(b->matches);
+	gtk_entry_completion_set_text_column(b->completion, 0);
+	gtk_entry_set_completion(GTK_ENTRY(b->entry), b->completion);
+	g_object_unref(b->completion);
+	gtk_entry_completion_set_match_func (b->completion, uri_entry_match_cb, NULL, NULL);
+	g_signal_connect(G_OBJECT (b->completion), "match-selected", G_CALLBACK (match_selected_cb), b);
 
 	gtk_toolbar_insert (GTK_TOOLBAR (toolbar), item, -1);
 
 	return toolbar;
 }
 static GtkWidget*
-create_window ()
+create_window (struct browser *b)
 {
 	GtkWidget* window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
 	gtk_window_set_default_size (GTK_WINDOW (window), WIDTH, HEIGHT);
 	gtk_widget_set_name (window, "Meme");
 
-	g_signal_connect(window, "destroy", G_CALLBACK (destroy_cb), NULL);
-	g_signal_connect(window, "key-press-event", G_CALLBACK(keypress_cb), NULL);
+	g_signal_connect(window, "destroy", G_CALLBACK (destroy_cb), b);
+	g_signal_connect(window, "key-press-event", G_CALLBACK(keypress_cb), b);
 
 	return window;
 }
+// start loading. opened is when the window was asked for
+static void
+browser_load (struct browser *b, const char *uri, unsigned long long opened)
+{
+	b->opened = opened;
+	b->committed = FALSE;
+	webkit_web_view_load_uri(b->view, uri);
+}
+static void
+browser_show (struct browser *b)
+{
+	update_title(b);
+	gtk_widget_show (b->window);
+	gtk_widget_grab_focus (GTK_WIDGET (b->view));
+}
+// load, then show: the request is under way while the window maps
+void
+browser_open (struct browser *b, const char *uri, unsigned long long opened)
+{
+	browser_load(b, uri, opened);
+	startup_mark("load");
+	browser_show(b);
+	startup_mark("shown");
+}
+// the view, loading uri unless it is NULL. the rest of the window can be
+// built while the network works
+static struct browser*
+browser_view (const char *uri, unsigned long long opened)
+{
+	struct browser *b = g_new0(struct browser, 1);
+	b->block = flag_block;
+	b->scroll = create_browser (b);
+	if (uri) browser_load(b, uri, opened);
+	startup_mark(uri ? "load": "view");
+	return b;
+}
+// build and realize the window around the view, and show it if loading
+static struct browser*
+browser_window (struct browser *b, gboolean show)
+{
+	GtkWidget* vbox = gtk_vbox_new (FALSE, 0);
+	gtk_box_pack_start (GTK_BOX (vbox), create_toolbar (b), FALSE, FALSE, 0);
+	gtk_box_pack_start (GTK_BOX (vbox), b->scroll, TRUE, TRUE, 0);
+
+	b->window = create_window (b);
+	gtk_container_add (GTK_CONTAINER (b->window), vbox);
+
+	gtk_widget_show_all (vbox);
+	gtk_widget_realize (b->window);
+	startup_mark("window");
+
+	browsers = g_list_prepend(browsers, b);
+	if (show)
+	{
+		browser_show(b);
+		startup_mark("shown");
+	}
+	return b;
+}
+// a NULL uri builds and realizes the window but leaves it hidden.
+// otherwise the load starts before the rest of the window is built
+struct browser*
+browser_new (const char *uri, unsigned long long opened)
+{
+	return browser_window(browser_view(uri, opened), uri != NULL);
+}
+// write one line to a listening UNIX socket
+static gboolean
+socket_send(const char *path, const char *msg)
+{
+	struct sockaddr_un addr = { AF_UNIX };
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return FALSE;
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)))
+	{
+		close(fd);
+		return FALSE;
+	}
+	gchar *line = g_strdup_printf("%s\n", msg);
+	gsize len = strlen(line), done = 0;
+	ssize_t n = 0;
+	while (done < len && (n = write(fd, line+done, len-done)) > 0) done += n;
+	g_free(line);
+	close(fd);
+	return done == len;
+}
+// bind path afresh and watch it for connections, returning the fd
+static int
+socket_listen(const char *path, int backlog, GIOFunc fn)
+{
+	struct sockaddr_un addr = { AF_UNIX };
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+	unlink(path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+	if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) || listen(fd, backlog))
+	{
+		fprintf(stderr, "could not listen: %s\n", path);
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	GIOChannel *io = g_io_channel_unix_new(fd);
+	g_io_add_watch(io, G_IO_IN, fn, NULL);
+	g_io_channel_unref(io);
+	return fd;
+}
+// read a client's lines with fn, without blocking the main loop
+static void
+socket_client(int fd, GIOFunc fn)
+{
+	GIOChannel *client = g_io_channel_unix_new(fd);
+	g_io_channel_set_close_on_unref(client, TRUE);
+	g_io_channel_set_flags(client, G_IO_FLAG_NONBLOCK, NULL);
+	g_io_add_watch(client, G_IO_IN|G_IO_HUP|G_IO_ERR, fn, NULL);
+	g_io_channel_unref(client);
+}
+// single-process mode: the first meme listens on CONTROLSOCKET and later
+// ones write it a URI per line, then exit
+static gboolean
+control_read_cb(GIOChannel *io, GIOCondition cond, gpointer data)
+{
+	gchar *line = NULL;
+	gsize len, term;
+	GIOStatus status = G_IO_STATUS_AGAIN;
+
+	while ((status = g_io_channel_read_line(io, &line, &len, &term, NULL)) == G_IO_STATUS_NORMAL)
+	{
+		line[term] = '\0';
+		browser_new(*line ? line: HOMEPAGE, now_ns());
+		g_free(line);
+	}
+	return status == G_IO_STATUS_AGAIN;
+}
+static gboolean
+control_accept_cb(GIOChannel *io, GIOCondition cond, gpointer data)
+{
+	int fd = accept(control_fd, NULL, NULL);
+	if (fd >= 0) socket_client(fd, control_read_cb);
+	return TRUE;
+}
+// hand the URI to a running meme and return TRUE, or become the one that
+// listens. the lock stops two new processes both deciding to listen
+static gboolean
+control_start(const char *uri)
+{
+	int lock = open(CONTROLSOCKET ".lock", O_RDWR|O_CREAT|O_CLOEXEC, 0600);
+	if (lock >= 0) flock(lock, LOCK_EX);
+
+	gboolean sent = socket_send(CONTROLSOCKET, uri);
+	if (!sent) control_fd = socket_listen(CONTROLSOCKET, 16, control_accept_cb);
+
+	if (lock >= 0) { flock(lock, LOCK_UN); close(lock); }
+	return sent;
+}
+// warm standby: STANDBYPOOL hidden processes with the window and web view
+// already built, each waiting on its own socket for "opened uri". a slot
+// belongs to whoever holds the flock on its lock file, so a duplicate
+// standby started for a taken slot exits before doing any work
+static int standby_slot = -1;
+static int standby_fd = -1, standby_lock = -1;
+static struct browser *standby;
+
+static void
+standby_path(char *buf, size_t len, int slot, const char *suffix)
+{
+	snprintf(buf, len, MEMEDIR "standby.%d%s", slot, suffix);
+}
+static int
+standby_own(int slot)
+{
+	char path[BLOCK];
+	standby_path(path, sizeof(path), slot, ".lock");
+	int fd = open(path, O_RDWR|O_CREAT|O_CLOEXEC, 0600);
+	if (fd >= 0 && !flock(fd, LOCK_EX|LOCK_NB)) return fd;
+	if (fd >= 0) close(fd);
+	return -1;
+}
+static void
+standby_spawn(int slot)
+{
+	char arg[16];
+	sprintf(arg, "%d", slot);
+	spawn(STANDBYWINDOW(arg, flag_verbose ? "-v": ""), NULL);
+}
+// start a standby for every slot nobody holds
+void
+standby_fill()
+{
+	int slot, fd;
+	for (slot = 0; slot < STANDBYPOOL; slot++)
+	{
+		if ((fd = standby_own(slot)) < 0) continue;
+		close(fd);
+		standby_spawn(slot);
+	}
+}
+static gboolean
+standby_fill_cb(gpointer data)
+{
+	standby_fill();
+	return FALSE;
+}
+// hand uri to a waiting standby. renaming its socket first is atomic, so
+// two requesters can never both get the same one
+gboolean
+standby_take(const char *uri, unsigned long long opened)
+{
+	char path[BLOCK], claim[BLOCK], pid[32];
+	int slot;
+	sprintf(pid, ".%d", (int)getpid());
+	gchar *line = g_strdup_printf("%llu %s", opened, uri);
+	gboolean sent = FALSE;
+	for (slot = 0; !sent && slot < STANDBYPOOL; slot++)
+	{
+		standby_path(path, sizeof(path), slot, "");
+		standby_path(claim, sizeof(claim), slot, pid);
+		if (rename(path, claim)) continue;
+		sent = socket_send(claim, line);
+		unlink(claim);
+	}
+	g_free(line);
+	return sent;
+}
+static gboolean standby_accept_cb(GIOChannel *io, GIOCondition cond, gpointer data);
+// nobody wanted this standby for STANDBYIDLE seconds. a requester claims
+// the socket by renaming it, so if unlinking it fails one has, and the
+// standby stays for the request; otherwise nobody can find it any more
+static gboolean
+standby_idle_cb(gpointer data)
+{
+	char path[BLOCK];
+	if (!standby) return FALSE;
+	if (standby_fd < 0) return TRUE;
+	standby_path(path, sizeof(path), standby_slot, "");
+	if (unlink(path)) return TRUE;
+	gtk_main_quit();
+	return FALSE;
+}
+static void
+standby_listen()
+{
+	char path[BLOCK];
+	standby_path(path, sizeof(path), standby_slot, "");
+	standby_fd = socket_listen(path, 1, standby_accept_cb);
+	if (standby_fd < 0) gtk_main_quit();
+}
+// show the prepared window, and free the slot for a replacement
+static void
+standby_wake(const char *uri, unsigned long long opened)
+{
+	struct browser *b = standby;
+	standby = NULL;
+	close(standby_lock);
+	standby_lock = -1;
+	standby_spawn(standby_slot);
+	browser_open(b, uri, opened);
+}
+static gboolean
+standby_read_cb(GIOChannel *io, GIOCondition cond, gpointer data)
+{
+	gchar *line = NULL;
+	gsize len, term;
+	GIOStatus status = g_io_channel_read_line(io, &line, &len, &term, NULL);
+	if (status == G_IO_STATUS_AGAIN) return TRUE;
+
+	if (status == G_IO_STATUS_NORMAL && standby)
+	{
+		char *uri;
+		line[term] = '\0';
+		unsigned long long opened = strtoull(line, &uri, 10);
+		standby_wake(*uri == ' ' && uri[1] ? uri+1: HOMEPAGE, opened);
+	}
+	// the requester gave up after claiming the socket: offer it again
+	else if (standby) standby_listen();
+	g_free(line);
+	return FALSE;
+}
+static gboolean
+standby_accept_cb(GIOChannel *io, GIOCondition cond, gpointer data)
+{
+	int fd = accept(standby_fd, NULL, NULL);
+	if (fd < 0) return TRUE;
+	// one request per standby, so stop listening
+	close(standby_fd);
+	standby_fd = -1;
+	socket_client(fd, standby_read_cb);
+	return FALSE;
+}
+// webkit's caches go down to almost nothing and JavaScript collects its
+// garbage, until memory has stayed low a while
+static void
+memory_act(int action, const char *why)
+{
+	char buf[BLOCK];
+	if (action == MEMORY_NONE) return;
+	unsigned long long t = now_ns();
+	if (action == MEMORY_TRIM)
+	{
+		// a smaller model prunes the memory and page caches down to it
+		webkit_set_cache_model(WEBKIT_CACHE_MODEL_DOCUMENT_VIEWER);
+		// every page shares one heap, so one collection covers them all
+		if (browsers)
+		{
+			struct browser *b = browsers->data;
+			JSGarbageCollect(webkit_web_frame_get_global_context(webkit_web_view_get_main_frame(b->view)));
+		}
+		malloc_trim(0);
+		meter_add(&memory_trim_meter, now_ns() - t);
+	}
+	else webkit_set_cache_model(CACHEMODEL);
+	memory_describe(buf, sizeof(buf));
+	fprintf(stderr, "memory %s on %s: %s\n", action == MEMORY_TRIM ? "trim": "restore", why, buf);
+}
+static gboolean
+memory_sample_cb(gpointer data)
+{
+	memory_act(memory_sample(memory), "budget");
+	return TRUE;
+}
+static gboolean
+memory_pressure_cb(GIOChannel *io, GIOCondition cond, gpointer data)
+{
+	if (cond & (G_IO_ERR|G_IO_HUP|G_IO_NVAL)) return FALSE;
+	memory_act(memory_pressure(memory), "pressure");
+	return TRUE;
+}
+// benchmark mode: load each URL of a list in turn, RUNS times over, and
+// print commit, onload and total times as JSON. a load is over once onload
+// has fired and the network has stayed idle BENCHIDLE ms; total runs up to
+// its last request. URLs are interleaved so drift hits them all alike
+struct bench_uri {
+	gchar *uri;
+	unsigned long long *commit, *onload, *total;  // ns from the request, per good run
+	int samples, failed;
+};
+struct bench {
+	struct bench_uri *uris;
+	int count, runs, run, at, failed;
+	struct browser *b;
+	unsigned long long start, committed, loaded, quiet;
+	guint timeout, idle;
+};
+struct bench*
+bench_new(const char *file, int runs)
+{
+	gchar *text, **lines;
+	int i;
+	if (!g_file_get_contents(file, &text, NULL, NULL)) return NULL;
+	lines = g_strsplit(text, "\n", -1);
+	g_free(text);
+
+	struct bench *m = g_new0(struct bench, 1);
+	m->runs = runs > 0 ? runs: 1;
+	m->uris = g_new0(struct bench_uri, g_strv_length(lines));
+	for (i = 0; lines[i]; i++)
+	{
+		g_strstrip(lines[i]);
+		if (!lines[i][0] || lines[i][0] == '#') continue;
+		struct bench_uri *u = &m->uris[m->count++];
+		u->uri = g_strdup(lines[i]);
+		u->commit = g_new0(unsigned long long, m->runs);
+		u->onload = g_new0(unsigned long long, m->runs);
+		u->total = g_new0(unsigned long long, m->runs);
+	}
+	g_strfreev(lines);
+	return m;
+}
+static int
+bench_compare(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long*)a, y = *(const unsigned long long*)b;
+	return x < y ? -1: x > y;
+}
+// nearest rank, in ms. sorts v
+static double
+bench_quantile(unsigned long long *v, int n, double q)
+{
+	if (!n) return 0;
+	qsort(v, n, sizeof(unsigned long long), bench_compare);
+	int rank = q * n + 0.999999;
+	return v[rank > 0 ? rank-1: 0] / 1e6;
+}
+static void
+bench_times(FILE *f, const char *name, unsigned long long *v, int n)
+{
+	fprintf(f, "\"%s\": { \"p50\": %.1f, \"p95\": %.1f, \"p99\": %.1f }", name,
+		bench_quantile(v, n, 0.5), bench_quantile(v, n, 0.95), bench_quantile(v, n, 0.99));
+}
+static void
+bench_report(FILE *f)
+{
+	int i, n = 0, all = 0;
+	for (i = 0; i < bench->count; i++) all += bench->uris[i].samples;
+	unsigned long long *commit = g_new(unsigned long long, all + 1);
+	unsigned long long *onload = g_new(unsigned long long, all + 1);
+	unsigned long long *total = g_new(unsigned long long, all + 1);
+
+	fprintf(f, "{ \"runs\": %d, \"uris\": [\n", bench->runs);
+	for (i = 0; i < bench->count; i++)
+	{
+		struct bench_uri *u = &bench->uris[i];
+		memcpy(commit + n, u->commit, u->samples * sizeof(unsigned long long));
+		memcpy(onload + n, u->onload, u->samples * sizeof(unsigned long long));
+		memcpy(total + n, u->total, u->samples * sizeof(unsigned long long));
+		n += u->samples;
+		fputs("\t{ \"uri\": ", f);
+		json_string(f, u->uri);
+		fprintf(f, ", \"samples\": %d, \"failed\": %d, ", u->samples, u->failed);
+		bench_times(f, "commit", u->commit, u->samples);
+		fputs(", ", f);
+		bench_times(f, "onload", u->onload, u->samples);
+		fputs(", ", f);
+		bench_times(f, "total", u->total, u->samples);
+		fprintf(f, " }%s\n", i+1 < bench->count ? ",": "");
+	}
+	fprintf(f, "], \"overall\": { \"samples\": %d, \"failed\": %d, ", n, bench->failed);
+	bench_times(f, "commit", commit, n);
+	fputs(", ", f);
+	bench_times(f, "onload", onload, n);
+	fputs(", ", f);
+	bench_times(f, "total", total, n);
+	fprintf(f, " }, \"rss\": %llu }\n", memory_rss());
+	fflush(f);
+	g_free(commit);
+	g_free(onload);
+	g_free(total);
+}
+static gboolean bench_next_cb(gpointer data);
+static void
+bench_done(gboolean ok)
+{
+	struct bench_uri *u = &bench->uris[bench->at];
+	if (bench->timeout) g_source_remove(bench->timeout);
+	if (bench->idle) g_source_remove(bench->idle);
+	bench->timeout = bench->idle = 0;
+	if (ok)
+	{
+		u->commit[u->samples] = bench->committed - bench->start;
+		u->onload[u->samples] = bench->loaded - bench->start;
+		u->total[u->samples] = (bench->quiet > bench->loaded ? bench->quiet: bench->loaded) - bench->start;
+		u->samples++;
+	}
+	else
+	{
+		u->failed++;
+		bench->failed++;
+		fprintf(stderr, "bench: %s did not load\n", u->uri);
+	}
+	bench->at++;
+	// not from inside webkit's own signal
+	g_idle_add(bench_next_cb, NULL);
+}
+static gboolean
+bench_timeout_cb(gpointer data)
+{
+	bench->timeout = 0;
+	webkit_web_view_stop_loading(bench->b->view);
+	bench_done(FALSE);
+	return FALSE;
+}
+static gboolean
+bench_idle_cb(gpointer data)
+{
+	unsigned long long now = now_ns();
+	if (requests_active) bench->quiet = 0;
+	else if (!bench->quiet) bench->quiet = now;
+	else if (now - bench->quiet >= BENCHIDLE * 1000000ULL)
+	{
+		bench->idle = 0;
+		bench_done(TRUE);
+		return FALSE;
+	}
+	return TRUE;
+}
+static gboolean
+bench_next_cb(gpointer data)
+{
+	if (bench->at == bench->count)
+	{
+		bench->at = 0;
+		bench->run++;
+	}
+	if (bench->run == bench->runs || !bench->count)
+	{
+		bench_report(stdout);
+		gtk_widget_destroy(bench->b->window);
+		return FALSE;
+	}
+	bench->start = now_ns();
+	bench->committed = bench->loaded = bench->quiet = 0;
+	bench->timeout = g_timeout_add(BENCHTIMEOUT, bench_timeout_cb, NULL);
+	webkit_web_view_load_uri(bench->b->view, bench->uris[bench->at].uri);
+	return FALSE;
+}
+void
+bench_status(struct browser *b, WebKitLoadStatus status)
+{
+	if (b != bench->b || !bench->timeout) return;
+	if (status == WEBKIT_LOAD_COMMITTED && !bench->committed) bench->committed = now_ns();
+	if (status == WEBKIT_LOAD_FAILED) bench_done(FALSE);
+}
+void
+bench_onload(struct browser *b)
+{
+	if (b != bench->b || !bench->timeout || !bench->committed || bench->loaded) return;
+	bench->loaded = now_ns();
+	bench->idle = g_timeout_add(50, bench_idle_cb, NULL);
+}
+// replay answers the session's requests as its HTTP proxy, from the
+// archive alone
+struct replay_wait {
+	SoupServer *server;
+	SoupMessage *msg;
+};
+static gboolean
+replay_unpause_cb(gpointer data)
+{
+	struct replay_wait *w = data;
+	soup_server_unpause_message(w->server, w->msg);
+	g_object_unref(w->msg);
+	g_free(w);
+	return FALSE;
+}
+static void
+replay_cb(SoupServer *server, SoupMessage *msg, const char *path, GHashTable *query, SoupClientContext *client, gpointer data)
+{
+	struct archive_entry e;
+	char *uri = soup_uri_to_string(soup_message_get_uri(msg), FALSE);
+	char *key = archive_key(msg->method, uri, msg->request_body->data, msg->request_body->length);
+	g_free(uri);
+	if (archive_find(replaying, key, &e))
+	{
+		soup_message_set_status(msg, SOUP_STATUS_NOT_FOUND);
+		meter_add(&replay_miss_meter, 1);
+		if (flag_verbose) fprintf(stderr, "replay miss: %s\n", key);
+		free(key);
+		return;
+	}
+	free(key);
+	soup_message_set_status(msg, e.status);
+	gchar *headers = g_strndup(e.headers, e.headers_len), **lines = g_strsplit(headers, "\n", -1), *value;
+	int i;
+	for (i = 0; lines[i]; i++)
+		if ((value = strstr(lines[i], ": ")))
+		{
+			*value = '\0';
+			soup_message_headers_append(msg->response_headers, lines[i], value+2);
+		}
+	g_strfreev(lines);
+	g_free(headers);
+	// the mapping outlives every request
+	soup_message_body_append(msg->response_body, SOUP_MEMORY_STATIC, e.body, e.body_len);
+	meter_add(&replay_hit_meter, e.body_len);
+	if (REPLAYLATENCY && e.latency >= 1000000)
+	{
+		struct replay_wait *w = g_new(struct replay_wait, 1);
+		w->server = server;
+		w->msg = g_object_ref(msg);
+		soup_server_pause_message(server, msg);
+		g_timeout_add(e.latency / 1000000, replay_unpause_cb, w);
+	}
+}
+static int
+replay_start(SoupSession *soup)
+{
+	char proxy[64];
+	SoupAddress *addr = soup_address_new("127.0.0.1", SOUP_ADDRESS_ANY_PORT);
+	soup_address_resolve_sync(addr, NULL);
+	replay_server = soup_server_new(SOUP_SERVER_INTERFACE, addr, NULL);
+	g_object_unref(addr);
+	if (!replay_server) return -1;
+	soup_server_add_handler(replay_server, NULL, replay_cb, NULL, NULL);
+	soup_server_run_async(replay_server);
+
+	snprintf(proxy, sizeof(proxy), "http://127.0.0.1:%u/", soup_server_get_port(replay_server));
+	SoupURI *uri = soup_uri_new(proxy);
+	g_object_set(G_OBJECT(soup), SOUP_SESSION_PROXY_URI, uri, NULL);
+	soup_uri_free(uri);
+	meter_register(&replay_hit_meter);
+	meter_register(&replay_miss_meter);
+	return 0;
+}
 int
 main (int argc, char* argv[])
 {
-	sigchld(0);
+	unsigned long long opened = now_ns();
+	startup_mark("exec");
+	// before gtk and webkit make the address space expensive to fork
+	launcher = launcher_new();
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sigchld;
+	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigaction(SIGCHLD, &sa, NULL);
+
 	gtk_init (&argc, &argv);
 	if (!g_thread_supported ())
 		g_thread_init (NULL);
+	startup_mark("gtk");
 
-	int i;
+	int i, runs = BENCHRUNS;
+	const char *bench_file = NULL, *record_file = NULL, *replay_file = NULL;
 	for(i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0' && argv[i][2] == '\0'; i++)
 	{
 		switch(argv[i][1]) {
 		case 'p':
 			flag_plugins = TRUE;
 			break;
+		case 's':
+			flag_single = TRUE;
+			break;
+		case 'v':
+			flag_verbose = TRUE;
+			break;
+		case 'T':
+			flag_timing = TRUE;
+			break;
+		case 'w':
+			if (i+1 < argc) standby_slot = atoi(argv[++i]);
+			break;
+		case 't':
+			if (i+1 < argc) snprintf(trace_file, sizeof(trace_file), "%s", argv[++i]);
+			break;
+		case 'b':
+			if (i+1 < argc) bench_file = argv[++i];
+			break;
+		case 'n':
+			if (i+1 < argc) runs = atoi(argv[++i]);
+			break;
+		case 'r':
+			if (i+1 < argc) record_file = argv[++i];
+			break;
+		case 'R':
+			if (i+1 < argc) replay_file = argv[++i];
+			break;
 		}
 	}
+	const char *uri = i < argc ? argv[i]: HOMEPAGE;
+	policy_defaults[POLICY_PLUGINS] = flag_plugins;
+
+	// the parent's NEWWINDOW request time, so first paint covers the exec
+	const char *t = getenv("MEME_OPENED");
+	if (t) opened = strtoull(t, NULL, 10);
+	unsetenv("MEME_OPENED");
+	startup_base = opened;
+
+	if (bench_file && !(bench = bench_new(bench_file, runs)))
+	{
+		fprintf(stderr, "could not read: %s\n", bench_file);
+		return 1;
+	}
+	if (replay_file && !(replaying = archive_open(replay_file)))
+	{
+		fprintf(stderr, "could not read: %s\n", replay_file);
+		return 1;
+	}
+	if (record_file && !(recording = archive_create(record_file)))
+	{
+		fprintf(stderr, "could not write: %s\n", record_file);
+		return 1;
+	}
+	// benchmarks, recording, replay and startup timing run in a process
+	// of their own, whatever else is open
+	gboolean alone = bench || recording || replaying || flag_timing;
+	if (standby_slot >= 0 && (standby_slot >= STANDBYPOOL || (standby_lock = standby_own(standby_slot)) < 0))
+		return 0;
+	if (!alone && flag_single && control_start(uri))
+		return 0;
+	if (!alone && !flag_single && standby_slot < 0 && standby_take(uri, opened))
+		return 0;
+	if (trace_file[0] && trace_start(trace_file))
+		fprintf(stderr, "could not write: %s\n", trace_file);
 
 	SoupSession *soup = webkit_get_default_session();
+	// the first page's host resolves on the resolver's thread while the
+	// rest of startup runs
+	SoupURI *first = standby_slot < 0 && !bench && !replaying ? soup_uri_new(uri): NULL;
+	if (first && first->host) soup_session_prepare_for_uri(soup, first);
+	if (first) soup_uri_free(first);
+
+	// what the first request needs: cookies, cache, policy and the session
+	if (COOKIEFILE)
+	{
+		cookie_jar = cookiejar_new(COOKIEFILE);
+		meter_register(&cookie_lookup_meter);
+		meter_register(&cookie_reload_meter);
+		meter_register(&cookie_flush_meter);
+	}
+	uri_index = completion_new();
+	if (HISTORYFILE)
+	{
+		history = history_new(HISTORYFILE, HISTORYHALFLIFE * 86400.0);
+		g_thread_create(load_history_thread, NULL, FALSE, NULL);
+		meter_register(&history_visit_meter);
+	}
+
 	soup_session_remove_feature_by_type(soup, soup_cookie_get_type());
 	soup_session_remove_feature_by_type(soup, soup_cookie_jar_get_type());
+	g_signal_connect(G_OBJECT(soup), "request-queued", G_CALLBACK(request_queued_cb), NULL);
 	g_signal_connect_after(G_OBJECT(soup), "request-started", G_CALLBACK(request_start_cb), NULL);
 	g_object_set(G_OBJECT(soup), SOUP_SESSION_MAX_CONNS, 100, NULL);
-	g_object_set(G_OBJECT(soup), SOUP_SESSION_MAX_CONNS_PER_HOST, 8, NULL);
-
-	GtkWidget* vbox = gtk_vbox_new (FALSE, 0);
-	gtk_box_pack_start (GTK_BOX (vbox), create_toolbar (), FALSE, FALSE, 0);
-	gtk_box_pack_start (GTK_BOX (vbox), create_browser (), TRUE, TRUE, 0);
-
-	main_window = create_window ();
-	gtk_container_add (GTK_CONTAINER (main_window), vbox);
+	netem.delay = NETEMDELAY;
+	netem.rate = NETEMRATE;
+	netem.loss = NETEMLOSS;
+	netem.rto = NETEMRTO;
+	netem.conns = NETEMCONNS;
+	apply_connections();
+	meter_register(&netem_meter);
+	downloads = downloads_new(soup, USERAGENT, DOWNLOADS, DOWNLOADSEGMENTS, download_event_cb, NULL);
+	if (DOWNLOADFILE && !alone && standby_slot < 0)
+		downloads_resume(downloads, DOWNLOADFILE);
+	// a replay comes from the archive alone, not the disk cache
+	if (replaying && replay_start(soup))
+		fprintf(stderr, "could not start replay\n");
+	if (!replaying) apply_cache(soup);
+	if (recording) meter_register(&record_meter);
+	webkit_set_cache_model(CACHEMODEL);
+	if (POLICYFILE)
+	{
+		policies = policies_new(POLICYFILE);
+		meter_register(&policy_meter);
+	}
+	if (http_cache && PREFETCHDWELL > 0)
+	{
+		prefetched = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+		meter_register(&prefetch_used_meter);
+		meter_register(&prefetch_wasted_meter);
+	}
+	if (PRECONNECTDWELL > 0)
+	{
+		preconnects = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+		meter_register(&preconnect_used_meter);
+		meter_register(&preconnect_wasted_meter);
+	}
+	startup_mark("session");
 
-	gtk_widget_grab_focus (GTK_WIDGET (web_view));
-	gtk_widget_show_all (main_window);
+	if (standby_slot >= 0)
+	{
+		standby = browser_new(NULL, 0);
+		standby_listen();
+		if (STANDBYIDLE) g_timeout_add_seconds(STANDBYIDLE, standby_idle_cb, NULL);
+	}
+	else
+	if (bench)
+	{
+		bench->b = browser_new(NULL, 0);
+		gtk_widget_show(bench->b->window);
+		g_idle_add(bench_next_cb, NULL);
+	}
+	else
+	{
+		struct browser *b = browser_view(uri, opened);
+		// one turn of the loop lets the session send the request, or start
+		// connecting once the host resolves, before the window is built.
+		// only here: elsewhere browser_new runs inside other handlers
+		g_main_context_iteration(NULL, FALSE);
+		browser_window(b, TRUE);
+		// once this window is under way, not competing with it
+		if (!alone && !flag_single && STANDBYPOOL)
+			g_timeout_add(STANDBYDELAY, standby_fill_cb, NULL);
+	}
 
-	webkit_web_view_load_uri(web_view, i < argc ? argv[i]: HOMEPAGE);
+	// the rest waits for nothing the main loop can deliver: the block lists
+	// are loaded before any subresource is requested, and a main document
+	// is never blocked
+	if (launcher_fd(launcher) >= 0)
+	{
+		GIOChannel *io = g_io_channel_unix_new(launcher_fd(launcher));
+		g_io_add_watch(io, G_IO_IN|G_IO_HUP|G_IO_ERR, launcher_cb, NULL);
+		g_io_channel_unref(io);
+	}
+	meter_register(&spawn_meter);
+	meter_register(&first_paint_meter);
+	meter_register(&completion_meter);
+	meter_register(&bookmark_add_meter);
+	meter_register(&hints_meter);
+	if (BLOCKDIR)
+	{
+		unsigned long long t = now_ns();
+		blocker = blocker_new();
+		blocker_load_dir(blocker, BLOCKDIR);
+		meter_add(&block_load_meter, now_ns() - t);
+		meter_register(&block_load_meter);
+		meter_register(&block_check_meter);
+	}
+	if (MEMORYBUDGET || MEMORYBUDGETALL || MEMORYPRESSURE)
+	{
+		memory = memory_new(MEMORYFILE, MEMORYBUDGET, MEMORYBUDGETALL);
+		memory_act(memory_sample(memory), "budget");
+		g_timeout_add(MEMORYSAMPLE, memory_sample_cb, NULL);
+		int fd = MEMORYPRESSURE ? memory_pressure_fd(MEMORYPRESSURE): -1;
+		if (fd >= 0)
+		{
+			GIOChannel *io = g_io_channel_unix_new(fd);
+			g_io_channel_set_close_on_unref(io, TRUE);
+			g_io_add_watch(io, G_IO_PRI|G_IO_ERR, memory_pressure_cb, NULL);
+			g_io_channel_unref(io);
+		}
+		meter_register(&memory_trim_meter);
+	}
+	meter_register(&request_meter);
+	meter_register(&request_dns_meter);
+	meter_register(&request_connect_meter);
+	meter_register(&request_ttfb_meter);
+	meter_register(&request_transfer_meter);
+	meter_register(&page_load_meter);
+	meter_register(&page_requests_meter);
+	meter_register(&page_bytes_meter);
+	meter_register(&page_hosts_meter);
+	if (STATSDIR)
+	{
+		g_mkdir_with_parents(STATSDIR, 0700);
+		g_timeout_add_seconds(STATSSAVE, stats_save_cb, NULL);
+	}
+	startup_mark("rest");
 
 	gtk_main ();
 
-	return 0;
+	if (control_fd >= 0) unlink(CONTROLSOCKET);
+	downloads_save(downloads, DOWNLOADFILE);
+	// whatever is left was never used
+	if (preconnects) preconnect_expire(now_ns() + PRECONNECTIDLE * 1000000000ULL);
+	if (prefetched) prefetch_expire(now_ns() + PREFETCHIDLE * 1000000000ULL);
+	if (http_cache)
+	{
+		soup_cache_flush(http_cache);
+		soup_cache_dump(http_cache);
+	}
+	if (cookie_jar && cookiejar_pending(cookie_jar)) flush_cookies_cb(NULL);
+	if (bookmarks && bookmarks_flush(bookmarks, TRUE))
+		fprintf(stderr, "could not write: %s\n", BOOKMARKFILE);
+	trace_stop();
+	if (flag_verbose) meter_dump(stderr);
+	if (STATSDIR)
+	{
+		char file[BLOCK];
+		snprintf(file, sizeof(file), "%s%d.json", STATSDIR, (int)getpid());
+		unlink(file);
+	}
+	memory_free(memory);
+	if (recording && archive_close(recording))
+		fprintf(stderr, "could not write: %s\n", record_file);
+	archive_close(replaying);
+	launcher_free(launcher);
+	return bench && bench->failed ? 1: 0;
 }
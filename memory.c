@@ -0,0 +1,201 @@
+// resident memory budgets for one meme process and for all of them
+//
+// RSS comes from /proc/self/statm, a few microseconds to read. every
+// process publishes its own in a small table mmap'd from a shared file:
+// one slot each, claimed under flock by writing its pid over a free or
+// dead one. the total is the sum of the live slots, read without locking;
+// a slot is one aligned 64 bit word per field, so a read is never torn.
+//
+// over either budget, or on kernel memory pressure, the answer is to
+// trim. trimming again while still over waits RETRIM seconds, so that
+// freeing has a chance to show. caches are restored only once both are
+// back under three quarters of budget and there has been no pressure for
+// HOLD seconds, so the two don't flap.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include "util.h"
+#include "memory.h"
+
+#define SLOTS 64
+#define RETRIM 30
+#define HOLD 60
+
+struct slot {
+	int64_t pid;
+	uint64_t rss;
+};
+
+struct memory {
+	struct slot *table;
+	int slot;
+	int trimmed;
+	unsigned long long budget, budget_all;
+	unsigned long long rss, rss_all;
+	int processes;
+	unsigned long long last_trim, last_pressure;
+	unsigned long long trims, restores, pressures;
+};
+
+static unsigned long long
+now_s()
+{
+	return now_ns() / 1000000000ULL;
+}
+static int
+alive(pid_t pid)
+{
+	return pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+static void
+claim(struct memory *m, int fd)
+{
+	int i, found = -1;
+	pid_t self = getpid();
+	flock(fd, LOCK_EX);
+	for (i = 0; i < SLOTS; i++)
+	{
+		if (m->table[i].pid == self) { found = i; break; }
+		if (found < 0 && !alive(m->table[i].pid)) found = i;
+	}
+	if (found >= 0)
+	{
+		m->table[found].rss = 0;
+		m->table[found].pid = self;
+	}
+	flock(fd, LOCK_UN);
+	m->slot = found;
+}
+struct memory*
+memory_new(const char *file, unsigned long long budget, unsigned long long budget_all)
+{
+	struct memory *m = calloc(1, sizeof(struct memory));
+	m->budget = budget;
+	m->budget_all = budget_all;
+	m->slot = -1;
+
+	int fd = file ? open(file, O_RDWR|O_CREAT|O_CLOEXEC, 0600): -1;
+	if (fd < 0) return m;
+	size_t size = SLOTS * sizeof(struct slot);
+	void *p = MAP_FAILED;
+	if (!ftruncate(fd, size))
+		p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p != MAP_FAILED)
+	{
+		m->table = p;
+		claim(m, fd);
+	}
+	close(fd);
+	return m;
+}
+void
+memory_free(struct memory *m)
+{
+	if (!m) return;
+	if (m->table && m->slot >= 0) m->table[m->slot].pid = 0;
+	if (m->table) munmap(m->table, SLOTS * sizeof(struct slot));
+	free(m);
+}
+int
+memory_pressure_fd(unsigned int stall_us)
+{
+	char trigger[64];
+	int fd = open("/proc/pressure/memory", O_RDWR|O_NONBLOCK|O_CLOEXEC);
+	if (fd < 0) return -1;
+	// unprivileged triggers need a window that is a multiple of 2s
+	int len = snprintf(trigger, sizeof(trigger), "some %u 2000000", stall_us);
+	if (write(fd, trigger, len + 1) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+unsigned long long
+memory_rss()
+{
+	static long page;
+	unsigned long long size, resident = 0;
+	if (!page) page = sysconf(_SC_PAGESIZE);
+	FILE *f = fopen("/proc/self/statm", "r");
+	if (!f) return 0;
+	if (fscanf(f, "%llu %llu", &size, &resident) != 2) resident = 0;
+	fclose(f);
+	return resident * page;
+}
+static int
+decide(struct memory *m, int pressure)
+{
+	unsigned long long now = now_s();
+	int over = (m->budget && m->rss > m->budget) || (m->budget_all && m->rss_all > m->budget_all);
+	if (pressure || over)
+	{
+		if (m->trimmed && now - m->last_trim < RETRIM) return MEMORY_NONE;
+		m->trimmed = 1;
+		m->last_trim = now;
+		m->trims++;
+		return MEMORY_TRIM;
+	}
+	if (!m->trimmed) return MEMORY_NONE;
+	if (m->budget && m->rss > m->budget / 4 * 3) return MEMORY_NONE;
+	if (m->budget_all && m->rss_all > m->budget_all / 4 * 3) return MEMORY_NONE;
+	if (m->pressures && now - m->last_pressure < HOLD) return MEMORY_NONE;
+	m->trimmed = 0;
+	m->restores++;
+	return MEMORY_RESTORE;
+}
+static void
+sample(struct memory *m)
+{
+	int i;
+	m->rss = m->rss_all = memory_rss();
+	m->processes = 1;
+	if (!m->table || m->slot < 0) return;
+
+	// someone took the slot while we weren't looking: a reused pid
+	if (m->table[m->slot].pid != getpid()) { m->slot = -1; return; }
+	m->table[m->slot].rss = m->rss;
+	for (i = 0; i < SLOTS; i++)
+	{
+		struct slot s = m->table[i];
+		if (i == m->slot || !s.pid || !alive(s.pid)) continue;
+		m->rss_all += s.rss;
+		m->processes++;
+	}
+}
+int
+memory_sample(struct memory *m)
+{
+	sample(m);
+	return decide(m, 0);
+}
+int
+memory_pressure(struct memory *m)
+{
+	m->pressures++;
+	m->last_pressure = now_s();
+	sample(m);
+	return decide(m, 1);
+}
+void
+memory_status(struct memory *m, struct memory_status *s)
+{
+	s->rss = m->rss;
+	s->rss_all = m->rss_all;
+	s->budget = m->budget;
+	s->budget_all = m->budget_all;
+	s->processes = m->processes;
+	s->trimmed = m->trimmed;
+	s->trims = m->trims;
+	s->restores = m->restores;
+	s->pressures = m->pressures;
+}
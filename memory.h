@@ -0,0 +1,39 @@
+// resident memory budgets for one meme process and for all of them
+
+#ifndef MEME_MEMORY_H
+#define MEME_MEMORY_H
+
+enum { MEMORY_NONE, MEMORY_TRIM, MEMORY_RESTORE };
+
+struct memory;
+
+// budget is bytes for this process and budget_all for every process
+// sharing file, 0 for no limit. file may be NULL to track only this one
+struct memory* memory_new(const char *file, unsigned long long budget, unsigned long long budget_all);
+void memory_free(struct memory *m);
+
+// a kernel PSI trigger on /proc/pressure/memory, firing when tasks stall on
+// memory for stall_us in any 2 second window. an fd to poll for POLLPRI,
+// or -1 when the kernel can't
+int memory_pressure_fd(unsigned int stall_us);
+
+// sample this process's RSS and publish it. says whether to trim caches
+// now, restore them, or do nothing
+int memory_sample(struct memory *m);
+
+// the pressure fd fired. same answer as memory_sample
+int memory_pressure(struct memory *m);
+
+// this process's resident bytes now
+unsigned long long memory_rss();
+
+struct memory_status {
+	unsigned long long rss, rss_all;      // bytes, at the last sample
+	unsigned long long budget, budget_all;
+	int processes;
+	int trimmed;                          // caches are cut down now
+	unsigned long long trims, restores, pressures;
+};
+void memory_status(struct memory *m, struct memory_status *s);
+
+#endif
@@ -0,0 +1,119 @@
+// emulated network conditions: latency, bandwidth, loss and connections
+//
+// nothing here touches a socket. the browser holds each response back for
+// as long as netem_hold says, so no root, qdisc or proxy is needed.
+//
+// bandwidth is one token bucket for the whole process, like one link. a
+// response reserves its length up front and the bucket may go into debt,
+// so responses arriving together queue behind each other and the last
+// waits for all their bytes. the bucket holds at most 100ms of tokens, the
+// burst an idle link can deliver at once. loss costs a retransmission
+// timeout, taken by a response with the chance of losing any of its
+// packets.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "netem.h"
+
+#define PACKET 1460
+
+struct preset {
+	const char *name;
+	unsigned int delay;
+	unsigned long long rate;
+	double loss;
+};
+
+// in the spirit of the usual browser throttling presets
+static struct preset presets[] = {
+	{ "2g", 800, 32000, 1 },
+	{ "3g", 300, 94000, 0.5 },
+	{ "slow3g", 400, 50000, 1 },
+	{ "dsl", 50, 250000, 0 },
+	{ NULL, 0, 0, 0 }
+};
+
+int
+netem_active(struct netem *n)
+{
+	return n->delay || n->rate || n->loss > 0;
+}
+int
+netem_parse(struct netem *n, const char *s)
+{
+	unsigned int delay, conns = 0;
+	unsigned long long rate;
+	double loss = 0;
+	int i;
+	while (*s == ' ') s++;
+	if (!strcmp(s, "off"))
+	{
+		n->delay = n->rate = n->conns = 0;
+		n->loss = 0;
+		return 0;
+	}
+	for (i = 0; presets[i].name; i++)
+	{
+		if (strcmp(s, presets[i].name)) continue;
+		n->delay = presets[i].delay;
+		n->rate = presets[i].rate;
+		n->loss = presets[i].loss;
+		return 0;
+	}
+	if (sscanf(s, "%u %llu %lf %u", &delay, &rate, &loss, &conns) < 2 || loss < 0 || loss > 100)
+		return -1;
+	n->delay = delay;
+	n->rate = rate;
+	n->loss = loss;
+	n->conns = conns;
+	return 0;
+}
+void
+netem_describe(struct netem *n, char *buf, size_t len)
+{
+	if (!netem_active(n) && !n->conns)
+	{
+		snprintf(buf, len, "off");
+		return;
+	}
+	int w = snprintf(buf, len, "%ums", n->delay);
+	if (n->rate) w += snprintf(buf+w, len-w, ", %.1fKB/s", n->rate / 1000.0);
+	else w += snprintf(buf+w, len-w, ", any bandwidth");
+	w += snprintf(buf+w, len-w, ", %.1f%% loss", n->loss);
+	if (n->conns) snprintf(buf+w, len-w, ", %u connections per host", n->conns);
+}
+static void
+refill(struct netem *n, unsigned long long now)
+{
+	double burst = n->rate / 10.0;
+	if (n->last && now > n->last) n->tokens += n->rate * ((now - n->last) / 1e9);
+	if (n->tokens > burst) n->tokens = burst;
+	n->last = now;
+}
+void
+netem_charge(struct netem *n, unsigned long long len, unsigned long long now)
+{
+	if (!n->rate) return;
+	refill(n, now);
+	n->tokens -= len;
+}
+unsigned long long
+netem_hold(struct netem *n, unsigned long long len, unsigned long long now)
+{
+	unsigned long long hold = n->delay * 1000000ULL;
+	if (n->rate)
+	{
+		netem_charge(n, len, now);
+		if (n->tokens < 0) hold += -n->tokens / n->rate * 1e9;
+	}
+	if (n->loss > 0)
+	{
+		// at least the request and the first packet back
+		double packets = 2 + len / PACKET;
+		double lost = 1 - pow(1 - n->loss / 100, packets);
+		if (drand48() < lost) hold += n->rto * 1000000ULL;
+	}
+	return hold;
+}
@@ -0,0 +1,33 @@
+// emulated network conditions: latency, bandwidth, loss and connections
+
+#ifndef MEME_NETEM_H
+#define MEME_NETEM_H
+
+#include <stddef.h>
+
+struct netem {
+	unsigned int delay;       // ms added to every response
+	unsigned long long rate;  // bytes per second shared by all responses, 0 for no limit
+	double loss;              // percent of responses that lose a packet
+	unsigned int rto;         // ms a lost packet costs
+	unsigned int conns;       // per host, 0 for the usual limit
+	double tokens;            // bytes the link may send now, negative when in debt
+	unsigned long long last;  // ns of the last refill
+};
+
+// "off", a preset such as "3g", or "DELAY RATE [LOSS [CONNS]]". -1 if
+// not understood, leaving n alone
+int netem_parse(struct netem *n, const char *s);
+
+void netem_describe(struct netem *n, char *buf, size_t len);
+int netem_active(struct netem *n);
+
+// ns to hold a response of len bytes, 0 when unknown, that arrives at now:
+// the delay, its turn on the shared link behind earlier responses, and
+// any loss
+unsigned long long netem_hold(struct netem *n, unsigned long long len, unsigned long long now);
+
+// bytes that went by without being announced, owed by later responses
+void netem_charge(struct netem *n, unsigned long long len, unsigned long long now);
+
+#endif
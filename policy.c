@@ -0,0 +1,240 @@
+// per-site WebKit settings from a file of host patterns
+//
+// each line is a host pattern followed by settings:
+//
+//   # heavy news sites, lean
+//   news.example.com  images=off scripts=off plugins=off
+//   example.org       spell=off pagecache=on
+//   *                 plugins=off
+//
+// a pattern covers the host and every subdomain, and "*" covers all. when
+// several cover a host, each setting comes from the most specific one
+// that mentions it. patterns compile into a hash table of domains, so a
+// lookup costs one probe per label of the host, however long the file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <sys/stat.h>
+#include "util.h"
+#include "policy.h"
+
+#define LINE 1024
+
+struct site {
+	char *name;
+	unsigned int hash, len;
+	struct policy policy;
+	struct site *next;
+};
+
+struct policies {
+	char *file;
+	struct site **sites;
+	unsigned int width, count;
+	struct policy any;
+	int rules;
+	int seen;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+};
+
+static const char *names[POLICIES] = { "images", "scripts", "plugins", "spell", "pagecache" };
+
+const char*
+policy_name(int setting)
+{
+	return setting >= 0 && setting < POLICIES ? names[setting]: NULL;
+}
+int
+policy_setting(const char *name)
+{
+	int i;
+	for (i = 0; i < POLICIES; i++)
+		if (!strcmp(name, names[i])) return i;
+	return -1;
+}
+static void
+clear(struct policies *p)
+{
+	unsigned int i;
+	struct site *s, *n;
+	for (i = 0; i < p->width; i++)
+		for (s = p->sites[i]; s; s = n) { n = s->next; free(s->name); free(s); }
+	memset(p->sites, 0, p->width * sizeof(struct site*));
+	memset(&p->any, 0, sizeof(p->any));
+	p->count = 0;
+	p->rules = 0;
+}
+static struct site*
+find(struct policies *p, const char *name, unsigned int len)
+{
+	unsigned int hash = hash_mem(name, len);
+	struct site *s;
+	for (s = p->sites[hash & (p->width-1)]; s; s = s->next)
+		if (s->hash == hash && s->len == len && !memcmp(s->name, name, len)) return s;
+	return NULL;
+}
+static struct site*
+add(struct policies *p, const char *name)
+{
+	unsigned int i, len = strlen(name);
+	struct site *s = find(p, name, len), *n;
+	if (s) return s;
+
+	if (p->count >= p->width)
+	{
+		unsigned int width = p->width * 2;
+		struct site **sites = calloc(width, sizeof(struct site*));
+		for (i = 0; i < p->width; i++)
+		{
+			for (s = p->sites[i]; s; s = n)
+			{
+				n = s->next;
+				s->next = sites[s->hash & (width-1)];
+				sites[s->hash & (width-1)] = s;
+			}
+		}
+		free(p->sites);
+		p->sites = sites;
+		p->width = width;
+	}
+	s = calloc(1, sizeof(struct site));
+	s->name = strdup(name);
+	s->len = len;
+	s->hash = hash_mem(name, len);
+	s->next = p->sites[s->hash & (p->width-1)];
+	p->sites[s->hash & (p->width-1)] = s;
+	p->count++;
+	return s;
+}
+// settings after the pattern, merged into any earlier line for it.
+// unknown settings and values are skipped, not guessed at
+static int
+parse(struct policies *p, char *line)
+{
+	char *save, *word, *value, *c;
+	int setting, bit;
+	struct policy policy = { 0, 0 };
+
+	char *pattern = strtok_r(line, " \t\r\n", &save);
+	if (!pattern || *pattern == '#') return 0;
+	while ((word = strtok_r(NULL, " \t\r\n", &save)))
+	{
+		if (!(value = strchr(word, '='))) continue;
+		*value++ = '\0';
+		if ((setting = policy_setting(word)) < 0) continue;
+		bit = 1 << setting;
+		if (!strcmp(value, "on")) policy.on |= bit;
+		else if (!strcmp(value, "off")) policy.on &= ~bit;
+		else continue;
+		policy.set |= bit;
+	}
+	if (!policy.set) return 0;
+
+	struct policy *into = &p->any;
+	if (strcmp(pattern, "*"))
+	{
+		for (c = pattern; *c; c++) *c = tolower((unsigned char)*c);
+		while (*pattern == '.' || *pattern == '*') pattern++;
+		if (!*pattern) return 0;
+		into = &add(p, pattern)->policy;
+	}
+	into->on = (into->on & ~policy.set) | policy.on;
+	into->set |= policy.set;
+	return 1;
+}
+static void
+load(struct policies *p, FILE *f)
+{
+	char line[LINE];
+	clear(p);
+	while (fgets(line, sizeof(line), f))
+		p->rules += parse(p, line);
+}
+struct policies*
+policies_new(const char *file)
+{
+	struct policies *p = calloc(1, sizeof(struct policies));
+	p->file = strdup(file);
+	p->width = 64;
+	p->sites = calloc(p->width, sizeof(struct site*));
+	policies_sync(p);
+	return p;
+}
+void
+policies_free(struct policies *p)
+{
+	if (!p) return;
+	clear(p);
+	free(p->sites);
+	free(p->file);
+	free(p);
+}
+int
+policies_sync(struct policies *p)
+{
+	struct stat st;
+	if (stat(p->file, &st))
+	{
+		if (!p->seen) return 0;
+		p->seen = 0;
+		clear(p);
+		return 1;
+	}
+	if (p->seen && st.st_dev == p->dev && st.st_ino == p->ino && st.st_size == p->size
+		&& st.st_mtim.tv_sec == p->mtime.tv_sec && st.st_mtim.tv_nsec == p->mtime.tv_nsec)
+		return 0;
+
+	FILE *f = fopen(p->file, "r");
+	if (!f) return 0;
+	fstat(fileno(f), &st);
+	load(p, f);
+	fclose(f);
+	p->seen = 1;
+	p->dev = st.st_dev;
+	p->ino = st.st_ino;
+	p->size = st.st_size;
+	p->mtime = st.st_mtim;
+	return 1;
+}
+int
+policies_count(struct policies *p)
+{
+	return p->rules;
+}
+static int
+merge(struct policy *out, const struct policy *in)
+{
+	unsigned int fresh = in->set & ~out->set;
+	if (!fresh) return 0;
+	out->on |= in->on & fresh;
+	out->set |= fresh;
+	return 1;
+}
+int
+policy_lookup(struct policies *p, const char *host, struct policy *out)
+{
+	char name[LINE];
+	unsigned int len, i;
+	const char *d;
+	struct site *s;
+	int applied = 0;
+
+	out->set = out->on = 0;
+	len = host ? strlen(host): 0;
+	if (len && len < sizeof(name) && p->count)
+	{
+		for (i = 0; i < len; i++) name[i] = tolower((unsigned char)host[i]);
+		name[len] = '\0';
+		// the host, then each parent domain
+		for (d = name; d; d = strchr(d, '.') ? strchr(d, '.') + 1: NULL)
+			if ((s = find(p, d, len - (d - name)))) applied += merge(out, &s->policy);
+	}
+	applied += merge(out, &p->any);
+	return applied;
+}
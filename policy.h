@@ -0,0 +1,33 @@
+// per-site WebKit settings from a file of host patterns
+
+#ifndef MEME_POLICY_H
+#define MEME_POLICY_H
+
+enum { POLICY_IMAGES, POLICY_SCRIPTS, POLICY_PLUGINS, POLICY_SPELL, POLICY_PAGECACHE, POLICIES };
+
+// bit 1 << POLICY_x of set is on when a rule decides setting x, and the
+// same bit of on says which way
+struct policy {
+	unsigned int set, on;
+};
+
+struct policies;
+
+struct policies* policies_new(const char *file);
+void policies_free(struct policies *p);
+
+// reload the file if its inode, size or mtime changed since last seen.
+// returns 1 when the rules were reloaded
+int policies_sync(struct policies *p);
+
+int policies_count(struct policies *p);
+
+// the settings for host: each decided by the most specific rule that
+// mentions it. returns the number of rules that applied
+int policy_lookup(struct policies *p, const char *host, struct policy *out);
+
+// "images", "scripts"... and back, -1 if unknown
+const char* policy_name(int setting);
+int policy_setting(const char *name);
+
+#endif
@@ -0,0 +1,86 @@
+// event counters with log2 histograms, dumped to stderr on exit with -v
+//
+// a value lands in the bucket of its highest set bit, one instruction, so
+// meters stay cheap enough for every request. quantiles interpolate
+// within a bucket and are good to a factor of two at worst.
+
+#include <string.h>
+#include "util.h"
+#include "stats.h"
+
+static struct meter *meters;
+
+void
+meter_register(struct meter *m)
+{
+	struct meter **p = &meters;
+	while (*p && *p != m) p = &(*p)->next;
+	if (!*p) *p = m;
+}
+void
+meter_add(struct meter *m, unsigned long long value)
+{
+	m->count++;
+	m->total += value;
+	if (value > m->max) m->max = value;
+	m->buckets[value ? 64 - __builtin_clzll(value): 0]++;
+}
+struct meter*
+meter_next(struct meter *m)
+{
+	return m ? m->next: meters;
+}
+unsigned long long
+meter_quantile(struct meter *m, double q)
+{
+	unsigned long long rank, seen = 0, lo, hi;
+	int i;
+	if (!m->count) return 0;
+	rank = q * m->count;
+	if (rank >= m->count) rank = m->count - 1;
+	for (i = 0; i < METER_BUCKETS; i++)
+	{
+		if (seen + m->buckets[i] > rank) break;
+		seen += m->buckets[i];
+	}
+	if (i == 0 || i == METER_BUCKETS) return i ? m->max: 0;
+	lo = 1ULL << (i-1);
+	hi = i < 64 ? (1ULL << i) - 1: ~0ULL;
+	if (hi > m->max) hi = m->max;
+	return lo + (hi - lo) * ((double)(rank - seen) + 0.5) / m->buckets[i];
+}
+void
+meter_json(FILE *f)
+{
+	struct meter *m;
+	int i, top;
+	fputc('{', f);
+	for (m = meters; m; m = m->next)
+	{
+		json_string(f, m->name);
+		fputs(": { \"unit\": ", f);
+		json_string(f, m->unit);
+		fprintf(f, ", \"count\": %llu, \"total\": %llu, \"max\": %llu", m->count, m->total, m->max);
+		fprintf(f, ", \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"buckets\": [",
+			meter_quantile(m, 0.5), meter_quantile(m, 0.9), meter_quantile(m, 0.99));
+		for (top = METER_BUCKETS; top > 0 && !m->buckets[top-1]; top--);
+		for (i = 0; i < top; i++) fprintf(f, "%s%llu", i ? ", ": "", m->buckets[i]);
+		fprintf(f, "] }%s\n", m->next ? ",": "");
+	}
+	fputs("}\n", f);
+}
+void
+meter_dump(FILE *f)
+{
+	struct meter *m;
+	for (m = meters; m; m = m->next)
+	{
+		if (!strcmp(m->unit, "ns"))
+			fprintf(f, "%-24s %10llu calls %10.1f us avg %10.1f us p99 %10.1f us max %12.1f ms total\n",
+				m->name, m->count, m->count ? m->total / 1000.0 / m->count: 0.0,
+				meter_quantile(m, 0.99) / 1000.0, m->max / 1000.0, m->total / 1000000.0);
+		else
+			fprintf(f, "%-24s %10llu events %12llu %s\n",
+				m->name, m->count, m->total, m->unit);
+	}
+}
@@ -0,0 +1,36 @@
+// event counters with log2 histograms, dumped to stderr on exit with -v
+
+#ifndef MEME_STATS_H
+#define MEME_STATS_H
+
+#include <stdio.h>
+
+#define METER_BUCKETS 65
+
+struct meter {
+	const char *name;
+	const char *unit; // "ns" meters are reported as timings
+	unsigned long long count;
+	unsigned long long total;
+	unsigned long long max;
+	struct meter *next;
+	// bucket 0 counts zeros, bucket i values in [2^(i-1), 2^i)
+	unsigned long long buckets[METER_BUCKETS];
+};
+
+#define METER(name, unit) { name, unit, 0, 0, 0, NULL, { 0 } }
+
+void meter_register(struct meter *m);
+void meter_add(struct meter *m, unsigned long long value);
+void meter_dump(FILE *f);
+
+// registered meters in order: meter_next(NULL) is the first
+struct meter* meter_next(struct meter *m);
+
+// estimated value below which fraction q of the values fall
+unsigned long long meter_quantile(struct meter *m, double q);
+
+// one JSON object of every meter by name, histograms included
+void meter_json(FILE *f);
+
+#endif
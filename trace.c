@@ -0,0 +1,143 @@
+// timeline of browser activity in the Chrome trace-event JSON format
+//
+// recording must not disturb what it records, so trace() only copies an
+// event into a ring buffer and a writer thread does the formatting and
+// I/O. there is one producer, the main thread, and one consumer, so the
+// ring needs no lock: the producer publishes a slot by advancing head
+// with a release store, and the writer frees it by advancing tail the
+// same way. when the writer falls a whole ring behind, new events are
+// dropped and counted rather than waited for.
+//
+// the file is a JSON array of events that chrome://tracing and Perfetto
+// open directly.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "util.h"
+#include "trace.h"
+
+#define RING 16384
+#define ARG 120
+
+// writer's poll interval when the ring is empty
+#define IDLE_NS 20000000
+
+struct event {
+	unsigned long long ns, id;
+	const char *cat, *name;
+	char phase;
+	char arg[ARG];
+};
+
+int trace_enabled;
+
+static struct event *ring;
+static unsigned long head, tail;
+static int stopping;
+static unsigned long long dropped;
+static FILE *out;
+static pthread_t writer;
+static int pid;
+
+static void
+write_event(FILE *f, struct event *e)
+{
+	fprintf(f, ",\n{ \"ph\": \"%c\", \"cat\": \"%s\", \"name\": \"%s\", \"ts\": %llu.%03llu, \"pid\": %d, \"tid\": %d",
+		e->phase, e->cat, e->name, e->ns / 1000, e->ns % 1000, pid, pid);
+	if (e->phase == 'b' || e->phase == 'e') fprintf(f, ", \"id\": \"0x%llx\"", e->id);
+	if (e->phase == 'i') fputs(", \"s\": \"t\"", f);
+	if (e->arg[0])
+	{
+		fputs(", \"args\": { \"arg\": ", f);
+		json_string(f, e->arg);
+		fputs(" }", f);
+	}
+	fputs(" }", f);
+}
+static void*
+write_thread(void *data)
+{
+	struct timespec idle = { 0, IDLE_NS };
+	unsigned long h, t;
+	for (;;)
+	{
+		int last = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+		h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+		for (t = tail; t != h; t++)
+		{
+			write_event(out, &ring[t % RING]);
+			__atomic_store_n(&tail, t + 1, __ATOMIC_RELEASE);
+		}
+		if (last) break;
+		fflush(out);
+		nanosleep(&idle, NULL);
+	}
+	return NULL;
+}
+int
+trace_start(const char *file)
+{
+	if (trace_enabled) return 0;
+	if (!(out = fopen(file, "w"))) return -1;
+	if (!ring) ring = malloc(RING * sizeof(struct event));
+	head = tail = 0;
+	dropped = 0;
+	stopping = 0;
+	pid = getpid();
+	fprintf(out, "[{ \"ph\": \"M\", \"name\": \"process_name\", \"pid\": %d, \"args\": { \"name\": \"meme %d\" } }",
+		pid, pid);
+	if (pthread_create(&writer, NULL, write_thread, NULL))
+	{
+		fclose(out);
+		out = NULL;
+		return -1;
+	}
+	trace_enabled = 1;
+	return 0;
+}
+void
+trace_stop()
+{
+	if (!trace_enabled) return;
+	trace_enabled = 0;
+	__atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+	pthread_join(writer, NULL);
+	if (dropped)
+	{
+		struct event e = { now_ns(), 0, "trace", "dropped", 'i', "" };
+		snprintf(e.arg, sizeof(e.arg), "%llu events", dropped);
+		write_event(out, &e);
+	}
+	fputs("\n]\n", out);
+	fclose(out);
+	out = NULL;
+}
+void
+trace(char phase, const char *cat, const char *name, unsigned long long id,
+	unsigned long long ns, const char *arg)
+{
+	if (!trace_enabled) return;
+	unsigned long h = head;
+	if (h - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) >= RING)
+	{
+		dropped++;
+		return;
+	}
+	struct event *e = &ring[h % RING];
+	e->ns = ns ? ns: now_ns();
+	e->id = id;
+	e->cat = cat;
+	e->name = name;
+	e->phase = phase;
+	size_t n = arg ? strnlen(arg, ARG): 0;
+	// too long: cut before the character that would be split, not inside it
+	if (n == ARG)
+		for (n = ARG - 1; n && ((unsigned char)arg[n] & 0xc0) == 0x80; n--);
+	if (n) memcpy(e->arg, arg, n);
+	e->arg[n] = '\0';
+	__atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+}
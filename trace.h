@@ -0,0 +1,22 @@
+// timeline of browser activity in the Chrome trace-event JSON format
+
+#ifndef MEME_TRACE_H
+#define MEME_TRACE_H
+
+// nonzero while tracing, for callers to skip building arguments
+extern int trace_enabled;
+
+// start writing events to file, replacing it. -1 if it can't be opened
+int trace_start(const char *file);
+
+// write out everything recorded and close the file
+void trace_stop();
+
+// record one event: phase is 'B'/'E' for a span on the main thread,
+// 'b'/'e' for an async span matched by id, or 'i' for an instant. cat and
+// name must be string literals; arg is copied and may be NULL. ns is a
+// now_ns() time, 0 for now. only ever call from the main thread
+void trace(char phase, const char *cat, const char *name, unsigned long long id,
+	unsigned long long ns, const char *arg);
+
+#endif
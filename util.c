@@ -0,0 +1,75 @@
+// small helpers shared by meme's non-GTK modules
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "util.h"
+
+unsigned int
+hash_mem(const void *p, unsigned long n)
+{
+	const unsigned char *s = p;
+	unsigned int h = 2166136261u;
+	while (n--) { h ^= *s++; h *= 16777619u; }
+	return h;
+}
+unsigned int
+hash_str(const char *s)
+{
+	unsigned int h = 2166136261u;
+	while (*s) { h ^= (unsigned char)*s++; h *= 16777619u; }
+	return h;
+}
+unsigned long long
+now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+// second level labels commonly used under two letter country codes
+static const char *second_levels[] = {
+	"ac", "co", "com", "edu", "gov", "net", "org", "or", "ne", "go", "ltd", "plc", "nom", "id", "asn", NULL
+};
+const char*
+host_registrable(const char *host)
+{
+	const char *p, *dots[3] = { NULL, NULL, NULL };
+	int i, numeric = 1;
+
+	if (*host == '.') host++;
+	for (p = host; *p; p++)
+	{
+		if (*p == ':') return host;
+		if (*p != '.' && !isdigit((unsigned char)*p)) numeric = 0;
+		if (*p == '.') { dots[2] = dots[1]; dots[1] = dots[0]; dots[0] = p; }
+	}
+	// IPv4 literals and single label hosts are their own site
+	if (numeric || !dots[0]) return host;
+
+	// dots[0] precedes the TLD, dots[1] the second level label
+	const char *tld = dots[0]+1;
+	const char *sld = dots[1] ? dots[1]+1: host;
+	if (strlen(tld) == 2)
+	{
+		for (i = 0; second_levels[i]; i++)
+		{
+			int n = strlen(second_levels[i]);
+			if (dots[0] - sld == n && !strncmp(sld, second_levels[i], n))
+				return dots[1] ? (dots[2] ? dots[2]+1: host): host;
+		}
+	}
+	return dots[1] ? dots[1]+1: host;
+}
+void
+json_string(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; s++)
+	{
+		if (*s == '"' || *s == '\\') fputc('\\', f);
+		if ((unsigned char)*s >= 0x20) fputc(*s, f);
+	}
+	fputc('"', f);
+}
@@ -0,0 +1,23 @@
+// small helpers shared by meme's non-GTK modules
+
+#ifndef MEME_UTIL_H
+#define MEME_UTIL_H
+
+#include <stdio.h>
+
+// FNV-1a
+unsigned int hash_str(const char *s);
+unsigned int hash_mem(const void *p, unsigned long n);
+
+// CLOCK_MONOTONIC in nanoseconds
+unsigned long long now_ns();
+
+// the registrable part of a hostname: "www.bbc.co.uk" -> "bbc.co.uk".
+// a heuristic, not the public suffix list, but stable: any domain that
+// domain-matches a host yields the same answer as the host itself.
+const char* host_registrable(const char *host);
+
+// s quoted for JSON. control characters are dropped
+void json_string(FILE *f, const char *s);
+
+#endif